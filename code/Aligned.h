@@ -0,0 +1,45 @@
+// Helpers to allocate memory aligned to a cache line, so that arrays can be
+// loaded straight into vector registers
+
+#ifndef ALIGNED_H
+#define ALIGNED_H
+
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <new>
+
+#define CACHE_LINE 64
+
+// size of a transparent huge page on x86 and most arm64 kernels
+#define HUGE_PAGE (2 << 20)
+
+// round n up to the next multiple of m
+inline size_t roundUp(size_t n, size_t m) {
+    return (n + m - 1) / m * m;
+}
+
+inline void* alignedAlloc(size_t bytes) {
+    void *memory = NULL;
+    if (posix_memalign(&memory, CACHE_LINE, roundUp(bytes, CACHE_LINE)) != 0)
+        throw std::bad_alloc();
+    return memory;
+}
+
+// whole huge pages, which the kernel is asked to back with huge pages where
+// it supports them. free with alignedFree() too
+inline void* hugePageAlloc(size_t bytes) {
+    void *memory = NULL;
+    size_t size = roundUp(bytes, HUGE_PAGE);
+    if (posix_memalign(&memory, HUGE_PAGE, size) != 0)
+        throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+    madvise(memory, size, MADV_HUGEPAGE);
+#endif
+    return memory;
+}
+
+inline void alignedFree(void *memory) {
+    free(memory);
+}
+
+#endif
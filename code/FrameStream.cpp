@@ -0,0 +1,65 @@
+#include "FrameStream.h"
+#include "Kernels.h"
+#include <vector>
+
+using std::string;
+using std::vector;
+
+FrameStream::FrameStream(const string &fileName, StreamFormat format,
+                         int width, int height, int fps) :
+format(format), width(width), height(height), next(0)
+{
+    file = fileName == "-" ? stdout : fopen(fileName.c_str(), "wb");
+    ok = file != NULL;
+
+    // 4:2:0 with the chroma in the middle of every 2x2 block, like the
+    // averages are
+    if (ok && format == Y4M_STREAM)
+        ok = fprintf(file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg XCOLORRANGE=LIMITED\n",
+                     width, height, fps) > 0;
+}
+
+FrameStream::~FrameStream() {
+    if (file == stdout)
+        fflush(file);
+    else if (file)
+        fclose(file);
+}
+
+bool FrameStream::write(Image *frame, int i) {
+
+    // the planes of a y4m frame, converted before it's this frame's turn
+    vector<unsigned char> planes;
+    if (format == Y4M_STREAM) {
+        size_t lumaBytes = (size_t)width * height;
+        size_t chromaBytes = (size_t)((width + 1) / 2) * ((height + 1) / 2);
+        planes.resize(lumaBytes + 2 * chromaBytes);
+        unsigned char *u = &planes[lumaBytes], *v = u + chromaBytes;
+        for (int y = 0; y < height; y += 2) {
+            int below = y + 1 < height ? y + 1 : y;
+            size_t chromaRow = (size_t)(y / 2) * ((width + 1) / 2);
+            getKernels()->rgbaToYUV420(frame->getRow(y), frame->getRow(below),
+                                       width, &planes[(size_t)y * width],
+                                       &planes[(size_t)below * width],
+                                       u + chromaRow, v + chromaRow);
+        }
+    }
+
+    std::unique_lock<std::mutex> guard(lock);
+    while (next != i)
+        turn.wait(guard);
+
+    // once writing failed the rest only keep the order
+    if (ok && format == Y4M_STREAM)
+        ok = fputs("FRAME\n", file) >= 0 &&
+             fwrite(&planes[0], 1, planes.size(), file) == planes.size();
+    else if (ok) {
+        size_t rowBytes = 4 * (size_t)width;
+        for (int y = 0; y < height && ok; ++y)
+            ok = fwrite(frame->getRow(y), 1, rowBytes, file) == rowBytes;
+    }
+
+    next++;
+    turn.notify_all();
+    return ok;
+}
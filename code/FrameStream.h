@@ -0,0 +1,49 @@
+// Header file that declares the output of the morph as one video stream
+// rather than a file per frame: YUV4MPEG2 (y4m), which ffmpeg and most video
+// encoders read from a pipe, or raw RGBA, to a file, a named pipe or stdout.
+// The frames may come from several writer threads in any order, every one
+// waits until the frames before it are out
+
+#ifndef FRAMESTREAM_H
+#define FRAMESTREAM_H
+
+#include "Image.h"
+#include <stdio.h>
+#include <string>
+#include <mutex>
+#include <condition_variable>
+
+enum StreamFormat {
+    Y4M_STREAM,     // BT.601 YUV 4:2:0 in limited range, alpha is dropped
+    RGBA_STREAM     // the rows of the frames, 4 bytes per pixel, no header
+};
+
+class FrameStream {
+private:
+        FILE *file;
+        StreamFormat format;
+        int width, height;
+        int next;       // the frame that goes out next
+        bool ok;
+        std::mutex lock;
+        std::condition_variable turn;
+public:
+        // "-" is stdout. the frames are width x height, fps frames a second
+        FrameStream(const std::string &fileName, StreamFormat format,
+                    int width, int height, int fps);
+        ~FrameStream();
+
+        // the stream is written in order, copies would make two orders
+        FrameStream(const FrameStream &) = delete;
+        FrameStream& operator=(const FrameStream &) = delete;
+
+        // false once the stream couldn't be opened or written
+        bool good() { return ok; }
+
+        // frame i of the morph, the first one is 0. converted on the calling
+        // thread, written once frame i - 1 is. every frame has to come
+        // exactly once, or the ones after it wait forever
+        bool write(Image *frame, int i);
+};
+
+#endif
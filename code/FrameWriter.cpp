@@ -0,0 +1,45 @@
+#include "FrameWriter.h"
+
+FrameWriter::FrameWriter(int width, int height, int buffers_, int writers_,
+                         const WriteFunction &write) :
+write(write), available(buffers_), finished(buffers_)
+{
+    for (int k = 0; k < buffers_; ++k) {
+        buffers.push_back(new Image(width, height, 4));
+        available.push(buffers.back());
+    }
+    for (int k = 0; k < writers_; ++k)
+        writers.push_back(std::thread(&FrameWriter::writerLoop, this));
+}
+
+FrameWriter::~FrameWriter() {
+    finish();
+    for (size_t k = 0; k < buffers.size(); ++k)
+        delete buffers[k];
+}
+
+void FrameWriter::writerLoop() {
+    Frame frame;
+    while (finished.pop(frame)) {
+        write(frame.image, frame.index);
+        available.push(frame.image);
+    }
+}
+
+Image* FrameWriter::acquire() {
+    Image *buffer = NULL;
+    available.pop(buffer);
+    return buffer;
+}
+
+void FrameWriter::submit(Image *frame, int i) {
+    Frame f = { frame, i };
+    finished.push(f);
+}
+
+void FrameWriter::finish() {
+    finished.close();
+    for (size_t k = 0; k < writers.size(); ++k)
+        writers[k].join();
+    writers.clear();
+}
@@ -0,0 +1,101 @@
+// Header file that defines the last stage of the morph, a few threads that
+// write the finished frames out while the next frames are being morphed.
+// The frames go through a fixed set of buffers: the morph takes a free one,
+// hands it over once the frame is in, and a writer hands it back after
+// writing it. When the writers fall behind the morph waits for a buffer, so
+// the memory never grows past the buffers
+
+#ifndef FRAMEWRITER_H
+#define FRAMEWRITER_H
+
+#include "Image.h"
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+// a queue of at most 'capacity' items, push() waits while it's full and
+// pop() while it's empty
+template <typename T>
+class BoundedQueue {
+private:
+        std::vector<T> items;   // a ring, 'count' items from 'head' on
+        size_t head, count;
+        bool closed;
+        std::mutex lock;
+        std::condition_variable notFull, notEmpty;
+public:
+        explicit BoundedQueue(size_t capacity) :
+        items(capacity), head(0), count(0), closed(false) {}
+
+        void push(const T &item) {
+            std::unique_lock<std::mutex> guard(lock);
+            while (count == items.size())
+                notFull.wait(guard);
+            items[(head + count) % items.size()] = item;
+            count++;
+            notEmpty.notify_one();
+        }
+
+        // false once the queue is closed and empty
+        bool pop(T &item) {
+            std::unique_lock<std::mutex> guard(lock);
+            while (count == 0 && !closed)
+                notEmpty.wait(guard);
+            if (count == 0)
+                return false;
+            item = items[head];
+            head = (head + 1) % items.size();
+            count--;
+            notFull.notify_one();
+            return true;
+        }
+
+        // no more pushes, pop() returns false once the rest is gone
+        void close() {
+            std::unique_lock<std::mutex> guard(lock);
+            closed = true;
+            notEmpty.notify_all();
+        }
+};
+
+class FrameWriter {
+public:
+        // write(frame, i) writes out frame i, it's called on the writer
+        // threads, several frames at the same time
+        typedef std::function<void(Image *frame, int i)> WriteFunction;
+private:
+        struct Frame {
+            Image *image;
+            int index;
+        };
+
+        WriteFunction write;
+        std::vector<Image*> buffers;
+        BoundedQueue<Image*> available;  // buffers that can be morphed into
+        BoundedQueue<Frame> finished;    // frames waiting for a writer
+        std::vector<std::thread> writers;
+
+        void writerLoop();
+public:
+        // 'buffers' frames of width x height, at least 1, and 'writers'
+        // threads, at least 1
+        FrameWriter(int width, int height, int buffers, int writers,
+                    const WriteFunction &write);
+
+        // writes out the frames that were handed over, see finish()
+        ~FrameWriter();
+
+        // a buffer for the next frame, waits for one if they are all busy
+        Image* acquire();
+
+        // hand over frame i, which was morphed into a buffer from acquire()
+        void submit(Image *frame, int i);
+
+        // wait for every frame handed over to be written, no more frames
+        // after that
+        void finish();
+};
+
+#endif
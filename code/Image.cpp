@@ -1,4 +1,5 @@
 #include "Image.h"
+#include "Aligned.h"
 #include <algorithm>
 #include <string.h>
 #include <math.h>
@@ -14,198 +15,258 @@ using std::min;
 using std::max;
 using std::floor;
 
+// number of rows handed to a thread at a time when the warp is given
+#define FIELD_GRAIN_ROWS 16
+
+// and when a batch of frames is morphed
+#define BATCH_GRAIN_ROWS 4
+
+// pixmaps of at least this many bytes go on huge pages, 0 - never
+static size_t hugePageBytes = 0;
+
+void Image::setHugePages(size_t minBytes) {
+    hugePageBytes = minBytes;
+}
+
+static unsigned char* allocatePixels(size_t bytes) {
+    if (hugePageBytes > 0 && bytes >= hugePageBytes)
+        return (unsigned char*)hugePageAlloc(bytes);
+    return (unsigned char*)alignedAlloc(bytes);
+}
+
 Image::Image(int width, int height, int channels) :
-width(width), height(height), channels(channels)
+width(width), height(height), channels(channels), tiled(false), planes(NULL)
 {
-    int numbytes = 4 * width * height;  // always use 4 channels
-    // allocate space for the pixmap
-    pixmap = new unsigned char[numbytes];
-
-    // setup the matrix access as well
-    matrix = new unsigned char *[height];
-    // set all the pointers appropriately
-    matrix[0] = pixmap;
-    for (int i = 1; i < height; ++i)
-        matrix[i] = matrix[i - 1] + 4 * width;
+    // always use 4 channels, and start every row on a cache line
+    stride = roundUp(4 * (size_t)width, CACHE_LINE);
+    pixmap = allocatePixels(stride * height);
 }
 
-// convert the input image to RGBA format if required
-void Image::copyImage(const unsigned char *pixmap_) {
-    // get the number of bytes to copy
-    int numbytes = channels * width * height;
-
-    if (channels == 1) {
-        // greyscale image
-        for (int i = 0, j = 0; i < numbytes; ++i, j += 4) {
-            pixmap[j] = pixmap_[i];
-            pixmap[j+1] = pixmap_[i];
-            pixmap[j+2] = pixmap_[i];
-            pixmap[j+3] = 255;
-        }
-    }
-    else if (channels == 3) {
-        // RGB image
-        int alphas = 0;  // the number of alphas we have seen till now
-        for (int i = 0; i < numbytes; ++i) {
-            if ((i + alphas) % 4 == 3) {
-                // we've seen an alpha
-                pixmap[i + alphas] = 255;
-                alphas++;
-            }
-            pixmap[i + alphas] = pixmap_[i];
-        }
-    }
-    else
-        memcpy(pixmap, pixmap_, numbytes);  // vanilla RGBA image, no need to do anything
+Image::~Image() {
+    setPlanar(false);
+    alignedFree(pixmap);
 }
 
-// flip the image upside down for displaying
-Image* Image::flip() {
+Image::Image(Image &&other) :
+width(other.width), height(other.height), channels(other.channels),
+tiled(other.tiled), pixmap(other.pixmap), stride(other.stride),
+planes(other.planes)
+{
+    other.pixmap = NULL;
+    other.planes = NULL;
+}
 
-    // flip the image for displaying
-    Image *reversed = new Image(width, height, channels);
+Image& Image::operator=(Image &&other) {
+    std::swap(width, other.width);
+    std::swap(height, other.height);
+    std::swap(channels, other.channels);
+    std::swap(tiled, other.tiled);
+    std::swap(pixmap, other.pixmap);
+    std::swap(stride, other.stride);
+    std::swap(planes, other.planes);
+    return *this;
+}
 
-    // copy the image row by row, from bottom to top, which ends up
-    // flipping it
-    for (int h = 0; h < height; ++h) {
-        for (int w = 0; w < width; ++w) {
-            pixel pix = getpixel(height - h - 1, w);
-            reversed->setpixel(h, w, pix);
-        }
-    }
+void Image::completeRGBA() {
+    for (int y = 0; y < height; ++y)
+        getKernels()->completeRGBA(getRow(y), channels, width);
+}
 
-    return reversed;
+// bytes from one row of tiles to the next
+static size_t tileRowBytes(int width) {
+    return roundUp(width, TEXTURE_TILE) * TEXTURE_TILE * 4;
 }
 
-// bilinear interpolation of point (x, y) based on the pixel color values
-pixel Image::sampleBilinear(float x, float y) {
+Texture Image::texture() {
+    size_t planeSize = roundUp((size_t)width * height, 16);
+    Texture t = { pixmap, width, height, (int)stride, tiled, planes, planeSize };
+    return t;
+}
 
-  int col0 = floor(x);
-  int col1 = col0 + 1;
-  int row0 = floor(y);
-  int row1 = row0 + 1;
+void Image::setPlanar(bool planar) {
 
-  // get the 4 neighbors for the current pixel
-  int pc0 = max(0, min(col0, width-1));
-  int pc1 = min(pc0+1, width-1);
-  int pr0 = max(0, min(row0, height-1));
-  int pr1 = min(pr0+1, height-1);
+    if (!planar) {
+        alignedFree(planes);
+        planes = NULL;
+        return;
+    }
+    if (planes)
+        return;
+
+    // the pixels are read row by row, whatever their layout
+    bool wasTiled = tiled;
+    setTiled(false);
+
+    size_t pixels = (size_t)width * height;
+    size_t planeSize = roundUp(pixels, 16);
+    planes = (float*)alignedAlloc(4 * planeSize * sizeof(float));
+    for (int c = 0; c < 4; ++c) {
+        float *plane = planes + c * planeSize;
+        for (int y = 0; y < height; ++y) {
+            const unsigned char *row = getRow(y);
+            for (int x = 0; x < width; ++x)
+                plane[(size_t)y * width + x] = row[4 * x + c];
+        }
+    }
 
-  // get the color values for the 4 neighbor pixels
-  pixel pix00 = getpixel(pr0, pc0);
-  pixel pix01 = getpixel(pr0, pc1);
-  pixel pix10 = getpixel(pr1, pc0);
-  pixel pix11 = getpixel(pr1, pc1);
+    setTiled(wasTiled);
+}
 
-  pixel result;
+void Image::setTiled(bool tiled_) {
+
+    if (tiled_ == tiled)
+        return;
+
+    size_t tileRows = (height + TEXTURE_TILE - 1) / TEXTURE_TILE;
+    size_t tileRow = tileRowBytes(width);
+    size_t rowStride = roundUp(4 * (size_t)width, CACHE_LINE);
+    size_t bytes = tiled_ ? tileRows * tileRow : height * rowStride;
+    unsigned char *converted = allocatePixels(bytes);
+    memset(converted, 0, bytes);
+
+    // a row of a tile at a time, which is next to the rest of the row in the
+    // image. the tiles on the right and bottom edges are padded
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; x += TEXTURE_TILE) {
+            size_t rows = y * rowStride + 4 * (size_t)x;
+            size_t tiles = y / TEXTURE_TILE * tileRow +
+                           (size_t)x * TEXTURE_TILE * 4 +
+                           y % TEXTURE_TILE * TEXTURE_TILE * 4;
+            size_t count = 4 * min(TEXTURE_TILE, width - x);
+            if (tiled_)
+                memcpy(converted + tiles, pixmap + rows, count);
+            else
+                memcpy(converted + rows, pixmap + tiles, count);
+        }
 
-  // perform the bilinear interpolation
-  for (int c = 0; c < 4; ++c) {
-    double res = 0;
+    alignedFree(pixmap);
+    pixmap = converted;
+    tiled = tiled_;
+    stride = tiled ? tileRow : rowStride;
+}
 
-    res += ((double)pix00[c]) * (col1 - x) * (row1 - y);
-    res += ((double)pix01[c]) * (col1 - x) * (y - row0);
-    res += ((double)pix10[c]) * (x - col0) * (row1 - y);
-    res += ((double)pix11[c]) * (x - col0) * (y - row0);
+// flip the image upside down for displaying
+Image Image::flip() {
 
-    // do not forget to clamp the values in case they go out of the range
-    result[c] = min(255, max(0, (int)floor(res)));
-  }
+    // flip the image for displaying
+    Image reversed(width, height, channels);
 
-  return result;
-}
+    // copy the image row by row, from bottom to top, which ends up
+    // flipping it
+    for (int h = 0; h < height; ++h)
+        memcpy(reversed.getRow(h), getRow(height - h - 1), 4 * (size_t)width);
 
-// map point (w, h) wrt to interLines to a new point 'src' wrt to the sourceLines
-vec2 warp(int w, int h,
-          std::vector<Line> &sourceLines,
-          std::vector<Line> &interLines,
-          int a, int p, int b) {
-
-  vec2 src;
-  vec2 input(w, h);  // the input point, wrt to the interLine
-  float X, Y;        // output point coordinates, wrt to the sourceLine
-
-  // store the weighted sum for the corresponding point in the source image
-  float sum_x = 0;
-  float sum_y = 0;
-  float weightSum = 0;
-
-  // tail = P
-  // head = Q
-  for (int i = 0; i < sourceLines.size(); i++) {
-	 
-	vec2 pd = input - interLines[i].P;
-	vec2 pq = interLines[i].Q - interLines[i].P;
-	// get the length of the interpolated feature segment PQ
-	float interLength = glm::length(pq);
-	float u = glm::dot(pd, pq) / (interLength * interLength);
-
-	// cross product between pd and pq
-	float v = (pd.x * pq.y - pd.y * pq.x) / interLength;
-
-	pq = sourceLines[i].Q - sourceLines[i].P;
-
-	 // get the length of the corresponding vector P'Q' in the source
-	float srcLength = glm::length(pq);
-	// corresponding point based on the current line
-	X = sourceLines[i].P.x + u * pq.x + v * pq.y / srcLength;
-	Y = sourceLines[i].P.y + u * pq.y - v * pq.x / srcLength;
-
-	// the sortest distance from the corresponding point to the line P'Q'
-	float dist;
-	if (u < 0)
-	  dist = glm::length(pd);
-	else if (u > 1)
-	  dist = glm::length(input - interLines[i].Q);
-	else
-	  dist = abs(v);
-
-	// perform a partial weighted sum
-	float weight = pow(pow(interLength, p) / (a + dist), b);
-	sum_x += X * weight;
-	sum_y += Y * weight;
-	weightSum += weight;
-  }
-
-  // average the computed sum values and return
-  src.x = sum_x / weightSum;
-  src.y = sum_y / weightSum;
-
-  return src;
+    return reversed;
 }
 
 void Image::morph(Image *destination,
                   Image *morphed,
-                  std::vector<Line> &sourceLines,
-                  std::vector<Line> &destLines,
-                  std::vector<Line> &interLines,
+                  const PreparedLines &lines,
                   float alpha,
-                  float a,
-                  float b,
-                  float p) {
+                  const WarpOptions &options,
+                  ThreadPool *pool) {
 
   // source = *this
 
-  for (int h = 0; h < height; ++h) {
-    for (int w = 0; w < width; ++w) {
-      // for each pixel
-      vec2 out1 = warp(w, h, sourceLines, interLines, a, p, b);
-      vec2 out2 = warp(w, h, destLines, interLines, a, p, b);
+  const MorphKernels *kernels = getKernels();
+  Texture sourceTexture = texture();
+  Texture destTexture = destination->texture();
 
-      // bilinear interpolation of the color values
-      pixel sPixel = sampleBilinear(out1.x, out1.y);
-      pixel dPixel = destination->sampleBilinear(out2.x, out2.y);
+  int bandRows = warpBandRows(lines, options);
 
-      pixel blend;
+  // morph the rows [first, last) of the output image
+  auto morphRows = [&](int first, int last) {
+    // the warped coordinates of one band of rows
+    WarpField field(width, bandRows);
 
-      // the good ol over operator applied to blend the two pixels together
-      blend.r = alpha * sPixel.r + (1-alpha) * dPixel.r;
-      blend.g = alpha * sPixel.g + (1-alpha) * dPixel.g;
-      blend.b = alpha * sPixel.b + (1-alpha) * dPixel.b;
-      blend.a = alpha * sPixel.a + (1-alpha) * dPixel.a;
+    for (int y0 = first; y0 < last; y0 += bandRows) {
+      int rows = min(bandRows, last - y0);
 
-      // set the new value
-      morphed->setpixel(h, w, blend);
+      // map the whole band onto the source and the destination
+      warpBand(lines, options, y0, rows, field);
+
+      // bilinear interpolation of the color values, blended together
+      for (int r = 0; r < rows; ++r) {
+        size_t row = (size_t)r * field.stride;
+        kernels->sampleBlendRow(sourceTexture, destTexture,
+                                field.srcX + row, field.srcY + row,
+                                field.dstX + row, field.dstY + row,
+                                width, alpha, morphed->getRow(y0 + r));
+      }
     }
-  }
+  };
+
+  // every band only depends on the inputs, never on the other bands, and
+  // the bands always start at the same rows, so they can be done in any order
+  // by any thread and the result is the same byte for byte as doing it all on
+  // one thread
+  if (pool)
+    pool->parallelFor(0, height, bandRows, morphRows);
+  else
+    morphRows(0, height);
+}
+
+void Image::morph(Image *destination,
+                  Image *morphed,
+                  const WarpField &field,
+                  float alpha,
+                  ThreadPool *pool) {
+
+  const MorphKernels *kernels = getKernels();
+  Texture sourceTexture = texture();
+  Texture destTexture = destination->texture();
+
+  auto morphRows = [&](int first, int last) {
+    for (int y = first; y < last; ++y) {
+      size_t row = (size_t)y * field.stride;
+      kernels->sampleBlendRow(sourceTexture, destTexture,
+                              field.srcX + row, field.srcY + row,
+                              field.dstX + row, field.dstY + row,
+                              width, alpha, morphed->getRow(y));
+    }
+  };
+
+  // every row only depends on the inputs, so it doesn't matter which thread
+  // does it
+  if (pool)
+    pool->parallelFor(0, height, FIELD_GRAIN_ROWS, morphRows);
+  else
+    morphRows(0, height);
+}
+
+void Image::morphBatch(Image *destination,
+                       Image **frames,
+                       const float *alpha,
+                       int count,
+                       const PreparedLines &lines,
+                       int alphas,
+                       ThreadPool *pool) {
+
+  const MorphKernels *kernels = getKernels();
+  Texture sourceTexture = texture();
+  Texture destTexture = destination->texture();
+
+  auto morphRows = [&](int first, int last) {
+    // the warped coordinates of a row at every alpha, one row per alpha
+    WarpField field(width, alphas);
+
+    for (int y = first; y < last; ++y) {
+      kernels->warpRowAlphas(lines, alphas, y, 0, width,
+                             field.srcX, field.srcY, field.dstX, field.dstY,
+                             field.stride);
+
+      for (int k = 0; k < count; ++k) {
+        size_t row = (size_t)k * field.stride;
+        kernels->sampleBlendRow(sourceTexture, destTexture,
+                                field.srcX + row, field.srcY + row,
+                                field.dstX + row, field.dstY + row,
+                                width, alpha[k], frames[k]->getRow(y));
+      }
+    }
+  };
+
+  if (pool)
+    pool->parallelFor(0, height, BATCH_GRAIN_ROWS, morphRows);
+  else
+    morphRows(0, height);
 }
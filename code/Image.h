@@ -9,61 +9,111 @@
 #include <vector>
 #include "glm/vec2.hpp"
 #include "Line.h"
+#include "PreparedLines.h"
+#include "Kernels.h"
+#include "Warp.h"
+#include "ThreadPool.h"
 #include <string>
 
 class Image {
         // model standard image attributes like specs(dimensions, no of channels),
-        // the actual image data and the matrix like interface which holds Lineers
-        // to each and every scanline of the raster image
+        // the actual image data and a matrix like interface to each and every
+        // scanline of the raster image
 private:
         int width, height, channels;
+        bool tiled;     // the pixmap is in tiles, see setTiled()
         unsigned char *pixmap;
-        unsigned char **matrix;  // access in true matrix style
+        size_t stride;  // bytes from one row (of tiles) to the next
+        float *planes;  // a plane of floats per channel, see setPlanar()
 
-        pixel sampleBilinear(float x, float y);
+        // view of the pixels for the sampling kernels
+        Texture texture();
 public:
+        // the pixmap is aligned to a cache line and so is every row, there
+        // may be padding at the end of a row
         Image(int width, int height, int channels);
+        ~Image();
 
-        // call to clean up
-        void destroy() {
-            delete[] matrix;
-            delete[] pixmap;
-        }
-        void copyImage(const unsigned char *pixmap_);
+        // images own their pixels, they can be moved but not copied
+        Image(Image &&other);
+        Image& operator=(Image &&other);
+        Image(const Image&) = delete;
+        Image& operator=(const Image&) = delete;
+
+        // pixmaps of at least this many bytes are allocated on huge pages,
+        // which saves TLB misses when the morph samples all over a large
+        // image. 0 (the default) turns it off
+        static void setHugePages(size_t minBytes);
+
+        // for decoders that write straight into the rows: the first
+        // 'channels' bytes of every pixel are set, fill in the rest of RGBA
+        void completeRGBA();
         // define some getters
         int getWidth()       { return width; }
         int getHeight()      { return height; }
+        size_t getStride()   { return stride; }
         unsigned char* getPixmap() { return pixmap; }
+        unsigned char* getRow(int y) { return pixmap + y * stride; }
 
         // routines to get and set pixel values at the given pixel location(x, y)
         pixel getpixel(int x, int y) {
-            unsigned char red = matrix[x][4*y];
-            unsigned char green = matrix[x][4*y + 1];
-            unsigned char blue = matrix[x][4*y + 2];
-            unsigned char alpha = matrix[x][4*y + 3];
-
-            return pixel(red, green, blue, alpha);
+            const unsigned char *p = getRow(x) + 4 * y;
+            return pixel(p[0], p[1], p[2], p[3]);
         }
 
         void setpixel(int x, int y, pixel pix) {
-            matrix[x][4*y] = pix.r;
-            matrix[x][4*y + 1] = pix.g;
-            matrix[x][4*y + 2] = pix.b;
-            matrix[x][4*y + 3] = pix.a;
+            unsigned char *p = getRow(x) + 4 * y;
+            p[0] = pix.r;
+            p[1] = pix.g;
+            p[2] = pix.b;
+            p[3] = pix.a;
         }
 
         // reverse the image for display purposes, returns a new image
-        Image* flip();
+        Image flip();
+
+        // keep the pixels in square tiles (see Texture) rather than row by
+        // row, so that the pixels the morph samples close together in the
+        // output are close together in memory too, also when the warp turns
+        // rows into columns. it's meant for the source and the destination,
+        // the pixel accessors, flip() and getPixmap() only work on rows
+        void setTiled(bool tiled);
+
+        // also keep the pixels as a plane of floats per channel, which the
+        // morph samples in float rather than in fixed point from the RGBA
+        // bytes. 16 more bytes per pixel. the planes are a copy, so only
+        // make them once the pixels are in
+        void setPlanar(bool planar);
+
+        // the rows of the output are split into bands which are handed out
+        // to the threads of the pool, pass NULL to run on the calling thread
+        void morph(Image *destination,
+                     Image *morphed,
+                     const PreparedLines &lines,
+                     float alpha,
+                     const WarpOptions &options,
+                     ThreadPool *pool = NULL
+                   );
+
+        // morph a batch of frames in one pass over the pixels, frame k at
+        // alphas[k] goes into frames[k]. the lines are interleaved for
+        // 'alphas' (a multiple of 16 >= count) alphas at a time, see
+        // MorphKernels::warpRowAlphas
+        void morphBatch(Image *destination,
+                          Image **frames,
+                          const float *alpha,
+                          int count,
+                          const PreparedLines &lines,
+                          int alphas,
+                          ThreadPool *pool = NULL
+                        );
 
+        // the same with the warped coordinates of the whole image given
         void morph(Image *destination,
                      Image *morphed,
-                     std::vector<Line> &sourceLines,
-                     std::vector<Line> &destLines,
-                     std::vector<Line> &interLines,
+                     const WarpField &field,
                      float alpha,
-                     float a,
-                     float b,
-                     float p
+                     ThreadPool *pool = NULL
                    );
 };
 
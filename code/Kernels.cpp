@@ -0,0 +1,59 @@
+#include "Kernels.h"
+#include <string.h>
+
+// all the variants, best first
+static const MorphKernels *variants[] = {
+    &avx512Kernels, &avx2Kernels, &sse2Kernels, &scalarKernels
+};
+
+static const MorphKernels *active = NULL;
+
+// check if the cpu we are running on can execute the given kernels
+static bool isSupported(const MorphKernels *kernels) {
+
+    if (kernels == &scalarKernels)
+        return true;
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (kernels == &sse2Kernels)
+        return __builtin_cpu_supports("sse2");
+    if (kernels == &avx2Kernels)
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    if (kernels == &avx512Kernels)
+        return __builtin_cpu_supports("avx512f") &&
+               __builtin_cpu_supports("avx512bw");
+#endif
+
+    // the vector variants are only built for x86, elsewhere they hold scalar code
+    return false;
+}
+
+const MorphKernels* getKernels() {
+
+    if (!active) {
+        // the first variant the cpu supports
+        for (size_t i = 0; i < sizeof(variants) / sizeof(variants[0]); ++i) {
+            if (isSupported(variants[i])) {
+                active = variants[i];
+                break;
+            }
+        }
+    }
+
+    return active;
+}
+
+bool selectKernels(const char *name) {
+
+    for (size_t i = 0; i < sizeof(variants) / sizeof(variants[0]); ++i) {
+        if (strcmp(variants[i]->name, name) == 0) {
+            if (!isSupported(variants[i]))
+                return false;
+            active = variants[i];
+            return true;
+        }
+    }
+
+    return false;
+}
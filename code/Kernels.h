@@ -0,0 +1,97 @@
+// Header file that declares the hot kernels of the morph. Every kernel is
+// compiled once per instruction set into its own table of function pointers,
+// the best table the cpu supports is picked at startup (or forced by name)
+
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <stddef.h>
+#include "PreparedLines.h"
+
+// tiled textures are stored in square tiles of 1 << TEXTURE_TILE_BITS pixels
+// on a side, the tiles row by row and the pixels of a tile row by row. the
+// image is padded to whole tiles
+#define TEXTURE_TILE_BITS 3
+#define TEXTURE_TILE (1 << TEXTURE_TILE_BITS)
+
+// RGBA image data that the sampling kernels read from
+struct Texture {
+    const unsigned char *pixels;
+    int width, height;
+    int stride;     // bytes from one row (of tiles) to the next
+    bool tiled;
+
+    // the same pixels as a plane of floats per channel, R, G, B then A, with
+    // width floats per row and planeSize floats per plane. NULL unless the
+    // image keeps them, see Image::setPlanar()
+    const float *planes;
+    size_t planeSize;
+};
+
+struct MorphKernels {
+    const char *name;
+
+    // map the pixels (x0, y) ... (x0 + n - 1, y) onto the source (srcX, srcY)
+    // and the destination (dstX, dstY). the rows need to be aligned to a cache
+    // line and have room for n rounded up to a multiple of 16
+    void (*warpRow)(const PreparedLines &lines, int y, int x0, int n,
+                    float *srcX, float *srcY, float *dstX, float *dstY);
+
+    // map the n points (x[k], y[k]) onto the source and the destination.
+    // every array needs to be aligned to a cache line and have room for n
+    // rounded up to a multiple of 16
+    void (*warpPoints)(const PreparedLines &lines, const float *x,
+                       const float *y, int n, float *srcX, float *srcY,
+                       float *dstX, float *dstY);
+
+    // map the pixels (x0, y) ... (x0 + n - 1, y) at several alphas at once.
+    // the lines are interleaved, line i at alpha k is line i * alphas + k and
+    // alphas is a multiple of 16. the coordinates at alpha k go into row k
+    // of every output, the rows are stride floats apart
+    void (*warpRowAlphas)(const PreparedLines &lines, int alphas, int y,
+                          int x0, int n, float *srcX, float *srcY,
+                          float *dstX, float *dstY, int stride);
+
+    // out = a + (b - a) t for n floats, to interpolate between two warp
+    // fields. the rows need to be aligned and padded like the ones of warpRow
+    void (*lerpRow)(const float *a, const float *b, int n, float t, float *out);
+
+    // bilinearly sample the source and the destination at the warped
+    // coordinates and cross dissolve them into n RGBA pixels. every
+    // instruction set samples the same, the scalar and sse2 kernels blend
+    // in float and the avx2 and avx512 ones in 16 bit fixed point, which is
+    // within +-1 of the float result. both textures need the same layout.
+    // textures with float planes are sampled from those, in float
+    void (*sampleBlendRow)(const Texture &source, const Texture &destination,
+                           const float *srcX, const float *srcY,
+                           const float *dstX, const float *dstY,
+                           int n, float alpha, unsigned char *out);
+
+    // turn RGBA pixels of which only the first 'channels' bytes are set into
+    // RGBA in place: greyscale (1), grey and alpha (2) or RGB (3)
+    void (*completeRGBA)(unsigned char *pixels, int channels, size_t n);
+
+    // a pair of rows of n RGBA pixels to BT.601 YUV 4:2:0 in limited range:
+    // a row of luma each, and (n + 1) / 2 blue and red chroma samples of the
+    // average of every 2x2 block. pass the same row twice for an odd last
+    // row. every instruction set gives the same bytes
+    void (*rgbaToYUV420)(const unsigned char *row0, const unsigned char *row1,
+                         int n, unsigned char *y0, unsigned char *y1,
+                         unsigned char *u, unsigned char *v);
+};
+
+// one table per instruction set, see Kernels<ISA>.cpp
+extern const MorphKernels scalarKernels;
+extern const MorphKernels sse2Kernels;
+extern const MorphKernels avx2Kernels;
+extern const MorphKernels avx512Kernels;
+
+// the kernels used by the morph, the best ones the cpu supports unless
+// selectKernels() picked others
+const MorphKernels* getKernels();
+
+// force the kernels for the given instruction set (scalar, sse2, avx2, avx512),
+// returns false if the name is unknown or the cpu can't run them
+bool selectKernels(const char *name);
+
+#endif
@@ -0,0 +1,27 @@
+// The morph kernels. This file is compiled once for every instruction set by
+// the Kernels<ISA>.cpp files, which define KERNELS_TABLE and KERNELS_NAME and
+// the compiler flags of that instruction set. All the code lives in an
+// anonymous namespace, so no function built for one instruction set can end
+// up being called by another variant
+
+#include "Kernels.h"
+#include "Simd.h"
+#include <string.h>
+
+namespace {
+
+#include "Warp.inl"
+#include "Pixels.inl"
+
+} // namespace
+
+extern const MorphKernels KERNELS_TABLE = {
+    KERNELS_NAME,
+    warpRow,
+    warpPoints,
+    warpRowAlphas,
+    lerpRow,
+    sampleBlendRow,
+    completeRGBA,
+    rgbaToYUV420
+};
@@ -0,0 +1,6 @@
+// Morph kernels for cpus with AVX2 and FMA, built with -mavx2 -mfma
+
+#define KERNELS_TABLE avx2Kernels
+#define KERNELS_NAME "avx2"
+
+#include "Kernels.inl"
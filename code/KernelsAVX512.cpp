@@ -0,0 +1,6 @@
+// Morph kernels for cpus with AVX-512, built with -mavx512f -mavx512bw
+
+#define KERNELS_TABLE avx512Kernels
+#define KERNELS_NAME "avx512"
+
+#include "Kernels.inl"
@@ -0,0 +1,6 @@
+// Morph kernels for cpus with SSE2, the x86-64 baseline
+
+#define KERNELS_TABLE sse2Kernels
+#define KERNELS_NAME "sse2"
+
+#include "Kernels.inl"
@@ -0,0 +1,7 @@
+// Morph kernels in plain C++, one value at a time and without intrinsics
+
+#define SIMD_SCALAR
+#define KERNELS_TABLE scalarKernels
+#define KERNELS_NAME "scalar"
+
+#include "Kernels.inl"
@@ -2,6 +2,7 @@
 #define Line_H
 
 #include "glm/vec2.hpp"
+#include <vector>
 
 using glm::vec2;
 
@@ -13,4 +14,15 @@ struct Line {
     Line(vec2 P, vec2 Q): P(P), Q(Q) { }
 };
 
+// the lines of the frame at alpha, from the destination lines (0) to the
+// source lines (1). interLines has to be as long as the others
+inline void interpolateLines(const std::vector<Line> &sourceLines,
+                             const std::vector<Line> &destLines,
+                             std::vector<Line> &interLines, float alpha) {
+    for (size_t i = 0; i < sourceLines.size(); ++i) {
+        interLines[i].P = (1 - alpha) * destLines[i].P + alpha * sourceLines[i].P;
+        interLines[i].Q = (1 - alpha) * destLines[i].Q + alpha * sourceLines[i].Q;
+    }
+}
+
 #endif
@@ -0,0 +1,149 @@
+#include "LineTree.h"
+#include "PreparedLines.h"
+#include <algorithm>
+#include <math.h>
+
+using std::max;
+
+// largest number of lines in a leaf of the tree
+#define LEAF_LINES 4
+
+void LineTree::build(const PreparedLines &prepared) {
+
+    nodes.clear();
+    lines.resize(prepared.count);
+    for (int i = 0; i < prepared.count; ++i)
+        lines[i] = i;
+
+    if (prepared.count == 0)
+        return;
+
+    // a binary tree never has more than twice as many nodes as leaves, so
+    // the nodes don't move while it is being built
+    nodes.reserve(2 * prepared.count);
+    build(prepared, 0, prepared.count);
+}
+
+// build the subtree over lines[first .. last), returns the index of its root
+int LineTree::build(const PreparedLines &prepared, int first, int last) {
+
+    const PreparedLines &l = prepared;
+    int node = nodes.size();
+    nodes.push_back(LineCluster());
+
+    LineCluster c = LineCluster();
+    c.children[0] = c.children[1] = -1;
+    c.first = first;
+    c.last = last;
+
+    float minX = HUGE_VALF, minY = HUGE_VALF, maxX = -HUGE_VALF, maxY = -HUGE_VALF;
+    for (int k = first; k < last; ++k) {
+        int i = lines[k];
+        float strength = l.p == 0 ? 1 : l.lenP[i];
+        float m = powf(strength, l.b);
+
+        // u and v / |P'Q'| as affine functions of the pixel
+        float ux = l.dx[i] * l.invLenSq[i], uy = l.dy[i] * l.invLenSq[i];
+        float u0 = -(l.px[i] * ux + l.py[i] * uy);
+        float vx = l.dy[i] * l.invLen[i], vy = -l.dx[i] * l.invLen[i];
+        float v0 = -(l.px[i] * vx + l.py[i] * vy);
+
+        // P' + u P'Q' + v perp(P'Q') / |P'Q'| for the source line
+        float sdx = l.srcDx[i], sdy = l.srcDy[i], s = l.srcInvLen[i];
+        c.srcXx += m * (sdx * ux + sdy * vx * s);
+        c.srcXy += m * (sdx * uy + sdy * vy * s);
+        c.srcX0 += m * (l.srcPx[i] + sdx * u0 + sdy * v0 * s);
+        c.srcYx += m * (sdy * ux - sdx * vx * s);
+        c.srcYy += m * (sdy * uy - sdx * vy * s);
+        c.srcY0 += m * (l.srcPy[i] + sdy * u0 - sdx * v0 * s);
+
+        // and for the destination line
+        float ddx = l.dstDx[i], ddy = l.dstDy[i], d = l.dstInvLen[i];
+        c.dstXx += m * (ddx * ux + ddy * vx * d);
+        c.dstXy += m * (ddx * uy + ddy * vy * d);
+        c.dstX0 += m * (l.dstPx[i] + ddx * u0 + ddy * v0 * d);
+        c.dstYx += m * (ddy * ux - ddx * vx * d);
+        c.dstYy += m * (ddy * uy - ddx * vy * d);
+        c.dstY0 += m * (l.dstPy[i] + ddy * u0 - ddx * v0 * d);
+
+        c.x += m * 0.5f * (l.px[i] + l.qx[i]);
+        c.y += m * 0.5f * (l.py[i] + l.qy[i]);
+        c.mass += m;
+
+        minX = std::min(minX, std::min(l.px[i], l.qx[i]));
+        minY = std::min(minY, std::min(l.py[i], l.qy[i]));
+        maxX = max(maxX, max(l.px[i], l.qx[i]));
+        maxY = max(maxY, max(l.py[i], l.qy[i]));
+    }
+
+    // the center is weighted the same way as the lines, which makes the
+    // first order error of using it for all of them cancel out
+    if (c.mass > 0) {
+        c.x /= c.mass;
+        c.y /= c.mass;
+    }
+    else {
+        c.x = 0.5f * (minX + maxX);
+        c.y = 0.5f * (minY + maxY);
+    }
+
+    for (int k = first; k < last; ++k) {
+        int i = lines[k];
+        float p = hypotf(l.px[i] - c.x, l.py[i] - c.y);
+        float q = hypotf(l.qx[i] - c.x, l.qy[i] - c.y);
+        c.radius = max(c.radius, max(p, q));
+    }
+
+    // split the lines in half along the longer side of their bounds
+    if (last - first > LEAF_LINES) {
+        bool alongX = maxX - minX >= maxY - minY;
+        int middle = (first + last) / 2;
+        std::nth_element(lines.begin() + first, lines.begin() + middle,
+                         lines.begin() + last, [&](int i, int j) {
+            return alongX ? l.px[i] + l.qx[i] < l.px[j] + l.qx[j]
+                          : l.py[i] + l.qy[i] < l.py[j] + l.qy[j];
+        });
+        c.children[0] = build(prepared, first, middle);
+        c.children[1] = build(prepared, middle, last);
+    }
+
+    nodes[node] = c;
+    return node;
+}
+
+void LineTree::gather(float x0, float y0, float x1, float y1, float theta,
+                      std::vector<int> &lineList,
+                      std::vector<int> &clusterList) const {
+
+    lineList.clear();
+    clusterList.clear();
+    if (nodes.empty())
+        return;
+
+    float cx = 0.5f * (x0 + x1), cy = 0.5f * (y0 + y1);
+    float halfDiagonal = 0.5f * hypotf(x1 - x0, y1 - y0);
+
+    int stack[64];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const LineCluster &c = nodes[stack[--top]];
+
+        // closest any pixel of the rectangle gets to the center
+        float distance = hypotf(c.x - cx, c.y - cy) - halfDiagonal;
+        if (distance > 0 && c.radius < theta * distance) {
+            clusterList.push_back(&c - &nodes[0]);
+            continue;
+        }
+
+        if (c.children[0] < 0) {
+            lineList.insert(lineList.end(), lines.begin() + c.first,
+                            lines.begin() + c.last);
+            continue;
+        }
+        stack[top++] = c.children[0];
+        stack[top++] = c.children[1];
+    }
+
+    std::sort(lineList.begin(), lineList.end());
+}
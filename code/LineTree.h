@@ -0,0 +1,58 @@
+// Header file that defines a tree over the feature lines of a frame, for
+// warping with thousands of lines. Every node is a cluster of nearby lines.
+// Seen from far enough away all the lines of a cluster are about as far from
+// a pixel as the cluster itself, and then their whole contribution to the warp
+// adds up to one term, see LineCluster. The tree tells which clusters are far
+// enough from a tile of pixels (Barnes-Hut style), the remaining lines are
+// warped one by one as usual
+
+#ifndef LINETREE_H
+#define LINETREE_H
+
+#include <vector>
+
+struct PreparedLines;
+
+// For a single line the point that pixel (x, y) maps to is affine in x and y,
+// and its weight is |PQ|^pb / (a + dist)^b. Using the distance to the center
+// of the cluster for all of its lines, the weighted sum over a cluster becomes
+//
+//     (srcXx x + srcXy y + srcX0, srcYx x + srcYy y + srcY0) / (a + dist)^b
+//
+// with the maps of the lines summed up weighted by |PQ|^pb, and likewise for
+// the destination. The weights themselves sum up to mass / (a + dist)^b
+struct LineCluster {
+    float x, y;         // center, the midpoints of the lines weighted by mass
+    float radius;       // distance from the center to the farthest end point
+    float mass;         // sum of |PQ|^pb
+
+    float srcXx, srcXy, srcX0, srcYx, srcYy, srcY0;
+    float dstXx, dstXy, dstX0, dstYx, dstYy, dstY0;
+
+    int children[2];    // -1 for the leaves
+    int first, last;    // the lines are lines[first .. last) of the tree
+};
+
+class LineTree {
+private:
+        std::vector<LineCluster> nodes;     // the root comes first
+        std::vector<int> lines;             // line indices, grouped by node
+
+        int build(const PreparedLines &prepared, int first, int last);
+public:
+        bool empty() const { return nodes.empty(); }
+
+        void build(const PreparedLines &prepared);
+
+        const LineCluster& cluster(int node) const { return nodes[node]; }
+
+        // split the tree for the pixels [x0, x1] x [y0, y1]: clusters that
+        // are farther away than their radius over theta can be summed up,
+        // the lines of the others are warped on their own. the lines come
+        // out in their usual order
+        void gather(float x0, float y0, float x1, float y1, float theta,
+                    std::vector<int> &lineList,
+                    std::vector<int> &clusterList) const;
+};
+
+#endif
@@ -0,0 +1,284 @@
+#include "Mesh.h"
+#include <algorithm>
+#include <math.h>
+
+using std::min;
+using std::max;
+using std::vector;
+
+// end points closer than this to each other halfway between the images, in
+// pixels, become one vertex
+#define MERGE_DISTANCE 0.5f
+
+// the span of a row is widened by this much on both sides, so the pixels on
+// an edge that two triangles share are never missed by both of them
+#define EDGE_EPSILON 1e-3f
+
+namespace {
+
+// a triangle of the Delaunay triangulation under construction, and its
+// circumcircle
+struct Delaunay {
+    int v[3];
+    double cx, cy, radiusSq;
+};
+
+struct Edge {
+    int a, b;
+};
+
+} // namespace
+
+static Delaunay makeTriangle(const vector<double> &x, const vector<double> &y,
+                             int a, int b, int c) {
+    Delaunay t = { { a, b, c }, 0, 0, HUGE_VAL };
+    double bx = x[b] - x[a], by = y[b] - y[a];
+    double cx = x[c] - x[a], cy = y[c] - y[a];
+    double d = 2 * (bx * cy - by * cx);
+    if (d != 0) {
+        double b2 = bx * bx + by * by, c2 = cx * cx + cy * cy;
+        double ux = (cy * b2 - by * c2) / d, uy = (bx * c2 - cx * b2) / d;
+        t.cx = x[a] + ux;
+        t.cy = y[a] + uy;
+        t.radiusSq = ux * ux + uy * uy;
+    }
+    return t;
+}
+
+// Bowyer-Watson: every point removes the triangles whose circumcircle it is
+// in and fills the hole with triangles fanning out from it. the first
+// triangle is large enough to hold all the points, the triangles that share
+// its corners are dropped at the end
+static void delaunay(vector<double> x, vector<double> y, vector<int> &result) {
+
+    int n = x.size();
+    double minX = *std::min_element(x.begin(), x.end());
+    double maxX = *std::max_element(x.begin(), x.end());
+    double minY = *std::min_element(y.begin(), y.end());
+    double maxY = *std::max_element(y.begin(), y.end());
+    double size = max(max(maxX - minX, maxY - minY), 1.0);
+    double midX = 0.5 * (minX + maxX), midY = 0.5 * (minY + maxY);
+    x.push_back(midX - 20 * size);
+    y.push_back(midY - size);
+    x.push_back(midX);
+    y.push_back(midY + 20 * size);
+    x.push_back(midX + 20 * size);
+    y.push_back(midY - size);
+
+    vector<Delaunay> triangles(1, makeTriangle(x, y, n, n + 1, n + 2));
+    vector<Edge> hole;
+    for (int i = 0; i < n; ++i) {
+        hole.clear();
+        size_t kept = 0;
+        for (size_t t = 0; t < triangles.size(); ++t) {
+            const Delaunay &d = triangles[t];
+            double dx = x[i] - d.cx, dy = y[i] - d.cy;
+            if (dx * dx + dy * dy < d.radiusSq) {
+                for (int e = 0; e < 3; ++e) {
+                    Edge edge = { d.v[e], d.v[(e + 1) % 3] };
+                    hole.push_back(edge);
+                }
+            }
+            else
+                triangles[kept++] = d;
+        }
+        triangles.resize(kept);
+
+        // the edges that only one of the removed triangles has are the
+        // boundary of the hole
+        for (size_t e = 0; e < hole.size(); ++e) {
+            bool shared = false;
+            for (size_t f = 0; f < hole.size(); ++f)
+                if (f != e && hole[e].a == hole[f].b && hole[e].b == hole[f].a)
+                    shared = true;
+            if (!shared)
+                triangles.push_back(makeTriangle(x, y, hole[e].a, hole[e].b, i));
+        }
+    }
+
+    result.clear();
+    for (size_t t = 0; t < triangles.size(); ++t) {
+        const int *v = triangles[t].v;
+        if (v[0] < n && v[1] < n && v[2] < n)
+            result.insert(result.end(), v, v + 3);
+    }
+}
+
+void WarpMesh::triangulate(const vector<Line> &sourceLines,
+                           const vector<Line> &destLines,
+                           int width_, int height_) {
+
+    width = width_;
+    height = height_;
+    vertices.clear();
+
+    // the corners first, they never move
+    float cornerX[4] = { 0, (float)width - 1, 0, (float)width - 1 };
+    float cornerY[4] = { 0, 0, (float)height - 1, (float)height - 1 };
+    vector<double> x, y;
+    for (int c = 0; c < 4; ++c) {
+        Vertex v = { -1, false, cornerX[c], cornerY[c] };
+        vertices.push_back(v);
+        x.push_back(cornerX[c]);
+        y.push_back(cornerY[c]);
+    }
+
+    for (size_t i = 0; i < sourceLines.size(); ++i)
+        for (int end = 0; end < 2; ++end) {
+            vec2 s = end ? sourceLines[i].Q : sourceLines[i].P;
+            vec2 d = end ? destLines[i].Q : destLines[i].P;
+            double hx = 0.5 * (s.x + d.x), hy = 0.5 * (s.y + d.y);
+
+            bool duplicate = false;
+            for (size_t k = 0; k < x.size() && !duplicate; ++k)
+                duplicate = fabs(x[k] - hx) < MERGE_DISTANCE &&
+                            fabs(y[k] - hy) < MERGE_DISTANCE;
+            if (duplicate)
+                continue;
+
+            Vertex v = { (int)i, end == 1, 0, 0 };
+            vertices.push_back(v);
+            x.push_back(hx);
+            y.push_back(hy);
+        }
+
+    delaunay(x, y, triangles);
+}
+
+void WarpMesh::prepare(const PreparedLines &lines) {
+
+    // where every vertex is in the frame (0), the source (1) and the
+    // destination (2)
+    size_t count = vertices.size();
+    vector<double> x[3], y[3];
+    for (int k = 0; k < 3; ++k) {
+        x[k].resize(count);
+        y[k].resize(count);
+    }
+    for (size_t i = 0; i < count; ++i) {
+        const Vertex &v = vertices[i];
+        if (v.line < 0) {
+            for (int k = 0; k < 3; ++k) {
+                x[k][i] = v.x;
+                y[k][i] = v.y;
+            }
+            continue;
+        }
+        int l = v.line;
+        float e = v.end ? 1 : 0;
+        x[0][i] = v.end ? lines.qx[l] : lines.px[l];
+        y[0][i] = v.end ? lines.qy[l] : lines.py[l];
+        x[1][i] = lines.srcPx[l] + e * lines.srcDx[l];
+        y[1][i] = lines.srcPy[l] + e * lines.srcDy[l];
+        x[2][i] = lines.dstPx[l] + e * lines.dstDx[l];
+        y[2][i] = lines.dstPy[l] + e * lines.dstDy[l];
+    }
+
+    // the affine maps from the frame onto the source and the destination,
+    // triangles that collapsed to a line in the frame don't cover any pixels
+    frame.clear();
+    for (size_t t = 0; t < triangles.size(); t += 3) {
+        const int *v = &triangles[t];
+        double x0 = x[0][v[0]], y0 = y[0][v[0]];
+        double x1 = x[0][v[1]] - x0, y1 = y[0][v[1]] - y0;
+        double x2 = x[0][v[2]] - x0, y2 = y[0][v[2]] - y0;
+        double det = x1 * y2 - x2 * y1;
+        if (fabs(det) < 1e-6)
+            continue;
+
+        Triangle triangle;
+        for (int k = 0; k < 3; ++k) {
+            triangle.x[k] = x[0][v[k]];
+            triangle.y[k] = y[0][v[k]];
+        }
+        for (int c = 0; c < 4; ++c) {
+            const vector<double> &f = c % 2 == 0 ? x[1 + c / 2] : y[1 + c / 2];
+            double f1 = f[v[1]] - f[v[0]], f2 = f[v[2]] - f[v[0]];
+            double fx = (f1 * y2 - f2 * y1) / det;
+            double fy = (f2 * x1 - f1 * x2) / det;
+            triangle.map[c][0] = fx;
+            triangle.map[c][1] = fy;
+            triangle.map[c][2] = f[v[0]] - fx * x0 - fy * y0;
+        }
+        frame.push_back(triangle);
+    }
+
+    // counting sort of the triangles into the bands of rows they touch
+    int bands = (height + MESH_BAND_ROWS - 1) / MESH_BAND_ROWS;
+    vector<int> first(frame.size()), last(frame.size());
+    bandStart.assign(bands + 1, 0);
+    for (size_t t = 0; t < frame.size(); ++t) {
+        const Triangle &triangle = frame[t];
+        float top = min(min(triangle.y[0], triangle.y[1]), triangle.y[2]);
+        float bottom = max(max(triangle.y[0], triangle.y[1]), triangle.y[2]);
+        first[t] = max((int)floorf(top) / MESH_BAND_ROWS, 0);
+        last[t] = min((int)floorf(bottom) / MESH_BAND_ROWS, bands - 1);
+        for (int b = first[t]; b <= last[t]; ++b)
+            bandStart[b + 1]++;
+    }
+    for (int b = 0; b < bands; ++b)
+        bandStart[b + 1] += bandStart[b];
+    bandTriangles.resize(bandStart[bands]);
+    vector<int> next(bandStart.begin(), bandStart.end() - 1);
+    for (size_t t = 0; t < frame.size(); ++t)
+        for (int b = first[t]; b <= last[t]; ++b)
+            bandTriangles[next[b]++] = t;
+}
+
+// fill in the pixels of the rows [y0, y0 + rows) that the triangle covers,
+// stepping the maps along every row with one add per pixel
+void WarpMesh::rasterize(const Triangle &t, int y0, int rows,
+                         WarpField &field) const {
+
+    float top = min(min(t.y[0], t.y[1]), t.y[2]);
+    float bottom = max(max(t.y[0], t.y[1]), t.y[2]);
+    int yFirst = max((int)ceilf(top), y0);
+    int yLast = min((int)floorf(bottom), y0 + rows - 1);
+
+    float *out[4] = { field.srcX, field.srcY, field.dstX, field.dstY };
+    for (int y = yFirst; y <= yLast; ++y) {
+        // where the row crosses the edges
+        float left = HUGE_VALF, right = -HUGE_VALF;
+        for (int e = 0; e < 3; ++e) {
+            float ya = t.y[e], yb = t.y[(e + 1) % 3];
+            if (ya == yb || y < min(ya, yb) || y > max(ya, yb))
+                continue;
+            float xa = t.x[e], xb = t.x[(e + 1) % 3];
+            float x = xa + (y - ya) * (xb - xa) / (yb - ya);
+            left = min(left, x);
+            right = max(right, x);
+        }
+        int xFirst = max((int)ceilf(left - EDGE_EPSILON), 0);
+        int xLast = min((int)floorf(right + EDGE_EPSILON), width - 1);
+        if (xFirst > xLast)
+            continue;
+
+        size_t row = (size_t)(y - y0) * field.stride;
+        for (int c = 0; c < 4; ++c) {
+            float *o = out[c] + row;
+            float step = t.map[c][0];
+            float value = step * xFirst + t.map[c][1] * y + t.map[c][2];
+            for (int x = xFirst; x <= xLast; ++x) {
+                o[x] = value;
+                value += step;
+            }
+        }
+    }
+}
+
+void WarpMesh::warpBand(int y0, int rows, WarpField &field) const {
+
+    for (int r = 0; r < rows; ++r) {
+        size_t row = (size_t)r * field.stride;
+        for (int x = 0; x < width; ++x) {
+            field.srcX[row + x] = field.dstX[row + x] = x;
+            field.srcY[row + x] = field.dstY[row + x] = y0 + r;
+        }
+    }
+
+    int band = y0 / MESH_BAND_ROWS;
+    if (band + 1 >= (int)bandStart.size())
+        return;
+    for (int k = bandStart[band]; k < bandStart[band + 1]; ++k)
+        rasterize(frame[bandTriangles[k]], y0, rows, field);
+}
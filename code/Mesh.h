@@ -0,0 +1,66 @@
+// Header file that defines a triangle mesh warp, an alternative to warping
+// with the feature lines. The end points of the lines and the corners of the
+// image are triangulated once, and every frame interpolates the vertices the
+// same way the lines are interpolated. Every triangle then maps its pixels
+// onto the source and the destination with its own affine map, so the cost
+// per pixel doesn't depend on the number of lines at all
+
+#ifndef MESH_H
+#define MESH_H
+
+#include <vector>
+#include "Line.h"
+#include "PreparedLines.h"
+#include "Warp.h"
+
+class WarpMesh {
+private:
+        // where a vertex comes from, the end point of a line or a corner
+        struct Vertex {
+            int line;       // -1 for the corners
+            bool end;       // Q rather than P
+            float x, y;     // the corner
+        };
+
+        // a triangle of the current frame, every component of the warped
+        // coordinates is map[c][0] x + map[c][1] y + map[c][2]
+        struct Triangle {
+            float x[3], y[3];       // the vertices in the frame
+            float map[4][3];        // srcX, srcY, dstX, dstY
+        };
+
+        int width, height;
+        std::vector<Vertex> vertices;
+        std::vector<int> triangles;     // 3 vertex indices each
+
+        // the triangles of the current frame, and the ones that touch each
+        // band of rows: bandTriangles[bandStart[b] .. bandStart[b + 1])
+        std::vector<Triangle> frame;
+        std::vector<int> bandStart;
+        std::vector<int> bandTriangles;
+
+        void rasterize(const Triangle &t, int y0, int rows,
+                       WarpField &field) const;
+public:
+        WarpMesh() : width(0), height(0) {}
+
+        // Delaunay triangulation of the end points and the corners of an
+        // image of the given size, halfway between the source and the
+        // destination where the two shapes disagree the least. end points
+        // that end up on top of each other there are only used once
+        void triangulate(const std::vector<Line> &sourceLines,
+                         const std::vector<Line> &destLines,
+                         int width, int height);
+
+        // move the vertices to the lines of the current frame
+        void prepare(const PreparedLines &lines);
+
+        // warp the rows [y0, y0 + rows), y0 has to be a multiple of
+        // MESH_BAND_ROWS. pixels that no triangle covers stay where they are
+        void warpBand(int y0, int rows, WarpField &field) const;
+};
+
+// number of rows warped at a time
+#define MESH_BAND_ROWS 16
+
+#endif
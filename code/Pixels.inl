@@ -0,0 +1,579 @@
+// Pixel kernels (sampling, blending and format conversion), included by
+// Kernels.inl
+
+inline int clampi(int v, int lo, int hi) {
+  return v < lo ? lo : (v > hi ? hi : v);
+}
+
+// the sampling coordinates are turned into fixed point numbers with this many
+// fractional bits, the integer part is the texel and the fraction weighs its
+// neighbors. coordinates are clamped to +-FIXED_LIMIT so they fit an int
+#define FRACTION_BITS 8
+#define FIXED_LIMIT (float)(1 << 30)
+
+// x in fixed point, rounded down. x * 256 is exact, so this is the texel
+// floorf(x) with (x - floorf(x)) * 256 rounded down as the fraction
+inline int toFixed(float x) {
+  float v = x * (1 << FRACTION_BITS);
+  v = v > -FIXED_LIMIT ? v : -FIXED_LIMIT;    // also takes care of NaNs
+  v = v < FIXED_LIMIT ? v : FIXED_LIMIT;
+  int i = (int)v;
+  return i - (i > v);
+}
+
+// where pixel (col, row) of the image is, in bytes
+template <bool Tiled>
+inline size_t pixelOffset(const Texture &image, int col, int row) {
+  if (!Tiled)
+    return (size_t)row * image.stride + 4 * col;
+  const int mask = TEXTURE_TILE - 1;
+  return (size_t)(row >> TEXTURE_TILE_BITS) * image.stride +
+         ((size_t)(col >> TEXTURE_TILE_BITS) << (2 * TEXTURE_TILE_BITS + 2)) +
+         ((row & mask) << (TEXTURE_TILE_BITS + 2)) + 4 * (col & mask);
+}
+
+// the 4 neighbors of the fixed point sample (x, y). samples near the edges
+// repeat the pixels of the edge
+template <bool Tiled>
+inline void neighbors(const Texture &image, int x, int y,
+                      const unsigned char *pixels[4]) {
+
+  int col = x >> FRACTION_BITS, row = y >> FRACTION_BITS;
+  int pc0 = clampi(col, 0, image.width - 1);
+  int pc1 = clampi(pc0 + 1, 0, image.width - 1);
+  int pr0 = clampi(row, 0, image.height - 1);
+  int pr1 = clampi(pr0 + 1, 0, image.height - 1);
+
+  pixels[0] = image.pixels + pixelOffset<Tiled>(image, pc0, pr0);
+  pixels[1] = image.pixels + pixelOffset<Tiled>(image, pc1, pr0);
+  pixels[2] = image.pixels + pixelOffset<Tiled>(image, pc0, pr1);
+  pixels[3] = image.pixels + pixelOffset<Tiled>(image, pc1, pr1);
+}
+
+// bilinear interpolation of the fixed point sample (x, y). the two pixels of
+// each row are blended by the fraction fy first, which is exact in 8.8 fixed
+// point, then the two rows by fx, rounding down. this swaps the fractions, the
+// right neighbor gets (1 - fx) fy and the one below fx (1 - fy), but that's
+// what the sampler has always done, so it's kept for the frames not to
+// change. every kernel samples the very same way, down to the rounding
+template <bool Tiled>
+inline void sampleBilinear(const Texture &image, int x, int y, int result[4]) {
+
+  const unsigned char *pixels[4];
+  neighbors<Tiled>(image, x, y, pixels);
+  const int one = 1 << FRACTION_BITS;
+  int fx = x & (one - 1), fy = y & (one - 1);
+
+  for (int c = 0; c < 4; ++c) {
+    int top = pixels[0][c] * (one - fy) + pixels[1][c] * fy;
+    int bottom = pixels[2][c] * (one - fy) + pixels[3][c] * fy;
+    int blended = top - (top * fx >> FRACTION_BITS) +
+                  (bottom * fx >> FRACTION_BITS);
+    result[c] = blended >> FRACTION_BITS;
+  }
+}
+
+#if !defined(SIMD_SCALAR) && defined(__SSE2__)
+
+// toFixed() for 4 coordinates, the compare makes up for cvttps rounding the
+// negative ones up
+inline __m128i toFixed(__m128 x) {
+  __m128 v = _mm_mul_ps(x, _mm_set1_ps(1 << FRACTION_BITS));
+  v = _mm_min_ps(_mm_max_ps(v, _mm_set1_ps(-FIXED_LIMIT)),
+                 _mm_set1_ps(FIXED_LIMIT));
+  __m128i i = _mm_cvttps_epi32(v);
+  __m128 roundedUp = _mm_cmpgt_ps(_mm_cvtepi32_ps(i), v);
+  return _mm_add_epi32(i, _mm_castps_si128(roundedUp));
+}
+
+// a + (b - a) t / 65536 for unsigned 16 bit lanes, rounded like
+// sampleBilinear() does. it never goes negative or past the larger of a and
+// b on the way
+inline __m128i lerp(__m128i a, __m128i b, __m128i t) {
+  return _mm_add_epi16(_mm_sub_epi16(a, _mm_mulhi_epu16(a, t)),
+                       _mm_mulhi_epu16(b, t));
+}
+
+// sampleBilinear() with the 4 channels in the 32 bit lanes
+template <bool Tiled>
+inline __m128i sampleBilinear(const Texture &image, int x, int y) {
+
+  int col = x >> FRACTION_BITS, row = y >> FRACTION_BITS;
+  __m128i top, bottom;
+
+  // the whole 2x2 footprint is in the image, and in a tiled one the pixels
+  // of a row are in the same tile: then they are next to each other and
+  // no clamping is needed
+  if ((unsigned)col < (unsigned)(image.width - 1) &&
+      (unsigned)row < (unsigned)(image.height - 1) &&
+      (!Tiled || (col & (TEXTURE_TILE - 1)) != TEXTURE_TILE - 1)) {
+    top = _mm_loadl_epi64((const __m128i*)
+        (image.pixels + pixelOffset<Tiled>(image, col, row)));
+    bottom = _mm_loadl_epi64((const __m128i*)
+        (image.pixels + pixelOffset<Tiled>(image, col, row + 1)));
+  }
+  else {
+    const unsigned char *pixels[4];
+    neighbors<Tiled>(image, x, y, pixels);
+    int p[4];
+    for (int k = 0; k < 4; ++k)
+      memcpy(&p[k], pixels[k], 4);
+    top = _mm_unpacklo_epi32(_mm_cvtsi32_si128(p[0]), _mm_cvtsi32_si128(p[1]));
+    bottom = _mm_unpacklo_epi32(_mm_cvtsi32_si128(p[2]), _mm_cvtsi32_si128(p[3]));
+  }
+
+  // the two pixels of a row in 16 bit lanes, weighed and added up
+  const int one = 1 << FRACTION_BITS;
+  int fx = x & (one - 1), fy = y & (one - 1);
+  __m128i zero = _mm_setzero_si128();
+  __m128i weights = _mm_set_epi16(fy, fy, fy, fy,
+                                  one - fy, one - fy, one - fy, one - fy);
+  top = _mm_mullo_epi16(_mm_unpacklo_epi8(top, zero), weights);
+  top = _mm_add_epi16(top, _mm_srli_si128(top, 8));
+  bottom = _mm_mullo_epi16(_mm_unpacklo_epi8(bottom, zero), weights);
+  bottom = _mm_add_epi16(bottom, _mm_srli_si128(bottom, 8));
+
+  __m128i blended = lerp(top, bottom, _mm_set1_epi16((short)(fx << FRACTION_BITS)));
+  return _mm_unpacklo_epi16(_mm_srli_epi16(blended, FRACTION_BITS), zero);
+}
+
+#endif
+
+#if !defined(SIMD_SCALAR) && defined(__AVX2__)
+
+inline __m256i toFixed(__m256 x) {
+  __m256 v = _mm256_mul_ps(x, _mm256_set1_ps(1 << FRACTION_BITS));
+  v = _mm256_min_ps(_mm256_max_ps(v, _mm256_set1_ps(-FIXED_LIMIT)),
+                    _mm256_set1_ps(FIXED_LIMIT));
+  __m256i i = _mm256_cvttps_epi32(v);
+  __m256 roundedUp = _mm256_cmp_ps(_mm256_cvtepi32_ps(i), v, _CMP_GT_OQ);
+  return _mm256_add_epi32(i, _mm256_castps_si256(roundedUp));
+}
+
+inline __m256i lerp(__m256i a, __m256i b, __m256i t) {
+  return _mm256_add_epi16(_mm256_sub_epi16(a, _mm256_mulhi_epu16(a, t)),
+                          _mm256_mulhi_epu16(b, t));
+}
+
+// a 16 bit value per 32 bit lane, repeated for the 4 channels of a pixel in
+// the order _mm256_unpack{lo,hi}_epi8 leave the pixels in: 0, 1, 4, 5 in lo
+// and 2, 3, 6, 7 in hi
+inline void spread(__m256i v, __m256i &lo, __m256i &hi) {
+  v = _mm256_or_si256(v, _mm256_slli_epi32(v, 16));
+  lo = _mm256_unpacklo_epi32(v, v);
+  hi = _mm256_unpackhi_epi32(v, v);
+}
+
+// pixelOffset() / 4 for 8 pixels, split into the parts that only depend on
+// the column and on the row. the rows (of tiles) have to be a multiple of 4
+// bytes apart
+template <bool Tiled>
+inline __m256i columnIndex(__m256i col) {
+  if (!Tiled)
+    return col;
+  __m256i mask = _mm256_set1_epi32(TEXTURE_TILE - 1);
+  return _mm256_add_epi32(
+      _mm256_slli_epi32(_mm256_srli_epi32(col, TEXTURE_TILE_BITS),
+                        2 * TEXTURE_TILE_BITS),
+      _mm256_and_si256(col, mask));
+}
+
+template <bool Tiled>
+inline __m256i rowIndex(const Texture &image, __m256i row) {
+  __m256i pitch = _mm256_set1_epi32(image.stride / 4);
+  if (!Tiled)
+    return _mm256_mullo_epi32(row, pitch);
+  __m256i mask = _mm256_set1_epi32(TEXTURE_TILE - 1);
+  return _mm256_add_epi32(
+      _mm256_mullo_epi32(_mm256_srli_epi32(row, TEXTURE_TILE_BITS), pitch),
+      _mm256_slli_epi32(_mm256_and_si256(row, mask), TEXTURE_TILE_BITS));
+}
+
+// sampleBilinear() for 8 pixels, the channels in 16 bit lanes in the order
+// of spread(), still in 8.8 fixed point but with the fractions cleared. the
+// 2x2 footprints are gathered with clamped indices, so the edges need no
+// special case
+template <bool Tiled>
+inline void sampleBilinear(const Texture &image, __m256i x, __m256i y,
+                           __m256i &lo, __m256i &hi) {
+
+  __m256i zero = _mm256_setzero_si256();
+  __m256i one = _mm256_set1_epi32(1);
+  __m256i lastCol = _mm256_set1_epi32(image.width - 1);
+  __m256i lastRow = _mm256_set1_epi32(image.height - 1);
+  __m256i col0 = _mm256_min_epi32(_mm256_max_epi32(
+      _mm256_srai_epi32(x, FRACTION_BITS), zero), lastCol);
+  __m256i row0 = _mm256_min_epi32(_mm256_max_epi32(
+      _mm256_srai_epi32(y, FRACTION_BITS), zero), lastRow);
+  __m256i col1 = _mm256_min_epi32(_mm256_add_epi32(col0, one), lastCol);
+  __m256i row1 = _mm256_min_epi32(_mm256_add_epi32(row0, one), lastRow);
+
+  // pixel indices, 4 bytes each
+  col0 = columnIndex<Tiled>(col0);
+  col1 = columnIndex<Tiled>(col1);
+  row0 = rowIndex<Tiled>(image, row0);
+  row1 = rowIndex<Tiled>(image, row1);
+  const int *base = (const int*)image.pixels;
+  __m256i p00 = _mm256_i32gather_epi32(base, _mm256_add_epi32(row0, col0), 4);
+  __m256i p01 = _mm256_i32gather_epi32(base, _mm256_add_epi32(row0, col1), 4);
+  __m256i p10 = _mm256_i32gather_epi32(base, _mm256_add_epi32(row1, col0), 4);
+  __m256i p11 = _mm256_i32gather_epi32(base, _mm256_add_epi32(row1, col1), 4);
+
+  __m256i fraction = _mm256_set1_epi32((1 << FRACTION_BITS) - 1);
+  __m256i fx = _mm256_and_si256(x, fraction);
+  __m256i fy = _mm256_and_si256(y, fraction);
+  __m256i full = _mm256_set1_epi32(1 << FRACTION_BITS);
+
+  // a (256 - fy) + b fy is at most 255 * 256, so it fits a 16 bit lane
+  __m256i y0lo, y0hi, y1lo, y1hi, xlo, xhi;
+  spread(_mm256_sub_epi32(full, fy), y0lo, y0hi);
+  spread(fy, y1lo, y1hi);
+  spread(_mm256_slli_epi32(fx, 8), xlo, xhi);
+
+  __m256i integer = _mm256_set1_epi16((short)0xff00);
+  __m256i top, bottom;
+
+  top = _mm256_add_epi16(
+      _mm256_mullo_epi16(_mm256_unpacklo_epi8(p00, zero), y0lo),
+      _mm256_mullo_epi16(_mm256_unpacklo_epi8(p01, zero), y1lo));
+  bottom = _mm256_add_epi16(
+      _mm256_mullo_epi16(_mm256_unpacklo_epi8(p10, zero), y0lo),
+      _mm256_mullo_epi16(_mm256_unpacklo_epi8(p11, zero), y1lo));
+  lo = _mm256_and_si256(lerp(top, bottom, xlo), integer);
+
+  top = _mm256_add_epi16(
+      _mm256_mullo_epi16(_mm256_unpackhi_epi8(p00, zero), y0hi),
+      _mm256_mullo_epi16(_mm256_unpackhi_epi8(p01, zero), y1hi));
+  bottom = _mm256_add_epi16(
+      _mm256_mullo_epi16(_mm256_unpackhi_epi8(p10, zero), y0hi),
+      _mm256_mullo_epi16(_mm256_unpackhi_epi8(p11, zero), y1hi));
+  hi = _mm256_and_si256(lerp(top, bottom, xhi), integer);
+}
+
+#endif
+
+template <bool Tiled>
+void sampleBlend(const Texture &source, const Texture &destination,
+                 const float *srcX, const float *srcY,
+                 const float *dstX, const float *dstY,
+                 int n, float alpha, unsigned char *out) {
+
+  int w = 0;
+
+#if !defined(SIMD_SCALAR) && defined(__AVX2__)
+  // 8 pixels at a time, all in 16 bit lanes. the samples are the same as
+  // the ones below, but the blend starts from the image with the larger
+  // weight and moves towards the other one by its weight in 0.16 fixed point
+  // instead of float math, so the result can be one less or one more, see
+  // MorphKernels::sampleBlendRow
+  {
+    int a = clampi((int)(alpha * 65536 + 0.5f), 0, 65536);
+    bool fromSource = a > 32768;
+    __m256i t = _mm256_set1_epi16((short)(fromSource ? 65536 - a : a));
+
+    for (; w + 8 <= n; w += 8, out += 32) {
+      __m256i sLo, sHi, dLo, dHi;
+      sampleBilinear<Tiled>(source, toFixed(_mm256_loadu_ps(srcX + w)),
+                            toFixed(_mm256_loadu_ps(srcY + w)), sLo, sHi);
+      sampleBilinear<Tiled>(destination, toFixed(_mm256_loadu_ps(dstX + w)),
+                            toFixed(_mm256_loadu_ps(dstY + w)), dLo, dHi);
+
+      __m256i lo = fromSource ? lerp(sLo, dLo, t) : lerp(dLo, sLo, t);
+      __m256i hi = fromSource ? lerp(sHi, dHi, t) : lerp(dHi, sHi, t);
+      lo = _mm256_srli_epi16(lo, FRACTION_BITS);
+      hi = _mm256_srli_epi16(hi, FRACTION_BITS);
+      _mm256_storeu_si256((__m256i*)out, _mm256_packus_epi16(lo, hi));
+    }
+  }
+#endif
+
+#if !defined(SIMD_SCALAR) && defined(__SSE2__)
+  // the coordinates of 4 pixels at a time go to fixed point, then every
+  // pixel is sampled and blended on its own
+  alignas(16) int fixed[4][4];
+  __m128 a = _mm_set1_ps(alpha), b = _mm_set1_ps(1 - alpha);
+  for (; w + 4 <= n; w += 4) {
+    _mm_store_si128((__m128i*)fixed[0], toFixed(_mm_loadu_ps(srcX + w)));
+    _mm_store_si128((__m128i*)fixed[1], toFixed(_mm_loadu_ps(srcY + w)));
+    _mm_store_si128((__m128i*)fixed[2], toFixed(_mm_loadu_ps(dstX + w)));
+    _mm_store_si128((__m128i*)fixed[3], toFixed(_mm_loadu_ps(dstY + w)));
+
+    for (int k = 0; k < 4; ++k, out += 4) {
+      __m128 s = _mm_cvtepi32_ps(
+          sampleBilinear<Tiled>(source, fixed[0][k], fixed[1][k]));
+      __m128 d = _mm_cvtepi32_ps(
+          sampleBilinear<Tiled>(destination, fixed[2][k], fixed[3][k]));
+      __m128i o = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(a, s), _mm_mul_ps(b, d)));
+      o = _mm_packs_epi32(o, o);
+      o = _mm_packus_epi16(o, o);
+      int rgba = _mm_cvtsi128_si32(o);
+      memcpy(out, &rgba, 4);
+    }
+  }
+#endif
+
+  for (; w < n; ++w, out += 4) {
+    int sPixel[4], dPixel[4];
+    sampleBilinear<Tiled>(source, toFixed(srcX[w]), toFixed(srcY[w]), sPixel);
+    sampleBilinear<Tiled>(destination, toFixed(dstX[w]), toFixed(dstY[w]), dPixel);
+
+    // the good ol over operator applied to blend the two pixels together
+    for (int c = 0; c < 4; ++c)
+      out[c] = alpha * sPixel[c] + (1 - alpha) * dPixel[c];
+  }
+}
+
+// coordinates of samples from float planes are clamped to +-PLANE_LIMIT,
+// which keeps their fractions and fits an int
+#define PLANE_LIMIT (float)(1 << 22)
+
+// bilinear interpolation of the sample (x, y) from the float planes of the
+// image, rounded down. the same swapped fractions as sampleBilinear(), the
+// pixels of a row are blended by fy and then the rows by fx, but all in float
+inline void samplePlanes(const Texture &image, float x, float y,
+                         float result[4]) {
+
+  x = x > -PLANE_LIMIT ? x : -PLANE_LIMIT;    // also takes care of NaNs
+  x = x < PLANE_LIMIT ? x : PLANE_LIMIT;
+  y = y > -PLANE_LIMIT ? y : -PLANE_LIMIT;
+  y = y < PLANE_LIMIT ? y : PLANE_LIMIT;
+  float col = floorf(x), row = floorf(y);
+  float fx = x - col, fy = y - row;
+
+  int pc0 = clampi((int)col, 0, image.width - 1);
+  int pc1 = clampi(pc0 + 1, 0, image.width - 1);
+  int pr0 = clampi((int)row, 0, image.height - 1);
+  int pr1 = clampi(pr0 + 1, 0, image.height - 1);
+  size_t top = (size_t)pr0 * image.width, bottom = (size_t)pr1 * image.width;
+
+  for (int c = 0; c < 4; ++c) {
+    const float *plane = image.planes + c * image.planeSize;
+    float t = plane[top + pc0] + (plane[top + pc1] - plane[top + pc0]) * fy;
+    float b = plane[bottom + pc0] + (plane[bottom + pc1] - plane[bottom + pc0]) * fy;
+    result[c] = floorf(t + (b - t) * fx);
+  }
+}
+
+#if !defined(SIMD_SCALAR) && defined(__AVX2__)
+
+// samplePlanes() for 8 pixels, a vector per channel
+inline void samplePlanes(const Texture &image, __m256 x, __m256 y,
+                         __m256 result[4]) {
+
+  __m256 limit = _mm256_set1_ps(PLANE_LIMIT);
+  __m256 minusLimit = _mm256_set1_ps(-PLANE_LIMIT);
+  x = _mm256_min_ps(_mm256_max_ps(x, minusLimit), limit);
+  y = _mm256_min_ps(_mm256_max_ps(y, minusLimit), limit);
+  __m256 col = _mm256_floor_ps(x), row = _mm256_floor_ps(y);
+  __m256 fx = _mm256_sub_ps(x, col), fy = _mm256_sub_ps(y, row);
+
+  __m256i zero = _mm256_setzero_si256();
+  __m256i one = _mm256_set1_epi32(1);
+  __m256i lastCol = _mm256_set1_epi32(image.width - 1);
+  __m256i lastRow = _mm256_set1_epi32(image.height - 1);
+  __m256i col0 = _mm256_min_epi32(_mm256_max_epi32(
+      _mm256_cvttps_epi32(col), zero), lastCol);
+  __m256i row0 = _mm256_min_epi32(_mm256_max_epi32(
+      _mm256_cvttps_epi32(row), zero), lastRow);
+  __m256i col1 = _mm256_min_epi32(_mm256_add_epi32(col0, one), lastCol);
+  __m256i row1 = _mm256_min_epi32(_mm256_add_epi32(row0, one), lastRow);
+
+  __m256i pitch = _mm256_set1_epi32(image.width);
+  row0 = _mm256_mullo_epi32(row0, pitch);
+  row1 = _mm256_mullo_epi32(row1, pitch);
+  __m256i i00 = _mm256_add_epi32(row0, col0), i01 = _mm256_add_epi32(row0, col1);
+  __m256i i10 = _mm256_add_epi32(row1, col0), i11 = _mm256_add_epi32(row1, col1);
+
+  for (int c = 0; c < 4; ++c) {
+    const float *plane = image.planes + c * image.planeSize;
+    __m256 p00 = _mm256_i32gather_ps(plane, i00, 4);
+    __m256 p01 = _mm256_i32gather_ps(plane, i01, 4);
+    __m256 p10 = _mm256_i32gather_ps(plane, i10, 4);
+    __m256 p11 = _mm256_i32gather_ps(plane, i11, 4);
+    __m256 t = _mm256_add_ps(p00, _mm256_mul_ps(_mm256_sub_ps(p01, p00), fy));
+    __m256 b = _mm256_add_ps(p10, _mm256_mul_ps(_mm256_sub_ps(p11, p10), fy));
+    result[c] = _mm256_floor_ps(_mm256_add_ps(t, _mm256_mul_ps(_mm256_sub_ps(b, t), fx)));
+  }
+}
+
+#endif
+
+void sampleBlendPlanes(const Texture &source, const Texture &destination,
+                       const float *srcX, const float *srcY,
+                       const float *dstX, const float *dstY,
+                       int n, float alpha, unsigned char *out) {
+
+  int w = 0;
+
+#if !defined(SIMD_SCALAR) && defined(__AVX2__)
+  // the channels of 8 pixels at a time, put together into RGBA at the end
+  __m256 a = _mm256_set1_ps(alpha), b = _mm256_set1_ps(1 - alpha);
+  for (; w + 8 <= n; w += 8, out += 32) {
+    __m256 s[4], d[4];
+    samplePlanes(source, _mm256_loadu_ps(srcX + w), _mm256_loadu_ps(srcY + w), s);
+    samplePlanes(destination, _mm256_loadu_ps(dstX + w), _mm256_loadu_ps(dstY + w), d);
+
+    __m256i rgba = _mm256_setzero_si256();
+    for (int c = 0; c < 4; ++c) {
+      __m256i o = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(a, s[c]),
+                                                    _mm256_mul_ps(b, d[c])));
+      rgba = _mm256_or_si256(rgba, _mm256_slli_epi32(o, 8 * c));
+    }
+    _mm256_storeu_si256((__m256i*)out, rgba);
+  }
+#endif
+
+  for (; w < n; ++w, out += 4) {
+    float sPixel[4], dPixel[4];
+    samplePlanes(source, srcX[w], srcY[w], sPixel);
+    samplePlanes(destination, dstX[w], dstY[w], dPixel);
+    for (int c = 0; c < 4; ++c)
+      out[c] = alpha * sPixel[c] + (1 - alpha) * dPixel[c];
+  }
+}
+
+void sampleBlendRow(const Texture &source, const Texture &destination,
+                    const float *srcX, const float *srcY,
+                    const float *dstX, const float *dstY,
+                    int n, float alpha, unsigned char *out) {
+  if (source.planes && destination.planes)
+    sampleBlendPlanes(source, destination, srcX, srcY, dstX, dstY, n, alpha, out);
+  else if (source.tiled)
+    sampleBlend<true>(source, destination, srcX, srcY, dstX, dstY, n, alpha, out);
+  else
+    sampleBlend<false>(source, destination, srcX, srcY, dstX, dstY, n, alpha, out);
+}
+
+// pixels the decoder only filled the first channels of, turned into RGBA in
+// place: grey (1) goes into all three colors, the alpha of grey and alpha
+// (2) moves to the last byte, and without alpha (1, 3) it's opaque
+void completeRGBA(unsigned char *pixels, int channels, size_t n) {
+
+  if (channels >= 4)
+    return;
+
+  size_t i = 0;
+#if !defined(SIMD_SCALAR) && defined(__SSE2__)
+  // 4 pixels at a time as 32 bit lanes, the bytes of a pixel from the low
+  // to the high one
+  __m128i low = _mm_set1_epi32(0xff);
+  __m128i color = _mm_set1_epi32(0xffffff);
+  __m128i opaque = _mm_set1_epi32((int)0xff000000);
+  for (; i + 4 <= n; i += 4) {
+    __m128i *p = (__m128i*)(pixels + 4 * i);
+    __m128i v = _mm_loadu_si128(p);
+    if (channels == 3) {
+      _mm_storeu_si128(p, _mm_or_si128(v, opaque));
+      continue;
+    }
+    __m128i grey = _mm_and_si128(v, low);
+    grey = _mm_or_si128(grey, _mm_slli_epi32(grey, 8));
+    grey = _mm_and_si128(_mm_or_si128(grey, _mm_slli_epi32(grey, 16)), color);
+    __m128i alpha = channels == 1 ? opaque :
+                    _mm_slli_epi32(_mm_srli_epi32(v, 8), 24);
+    _mm_storeu_si128(p, _mm_or_si128(grey, alpha));
+  }
+#endif
+  for (; i < n; ++i) {
+    unsigned char *p = pixels + 4 * i;
+    if (channels == 3) {
+      p[3] = 255;
+      continue;
+    }
+    p[3] = channels == 1 ? 255 : p[1];
+    p[1] = p[2] = p[0];
+  }
+}
+
+// BT.601 in limited range (16..235 for luma), in 8 bit fixed point
+static inline unsigned char lumaOf(int r, int g, int b) {
+  return ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+}
+
+static inline unsigned char blueOf(int r, int g, int b) {
+  return ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+}
+
+static inline unsigned char redOf(int r, int g, int b) {
+  return ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+}
+
+#if !defined(SIMD_SCALAR) && defined(__SSE2__)
+// red, green and blue of 8 RGBA pixels in 16 bit lanes
+static inline void splitChannels(const unsigned char *p, __m128i c[3]) {
+  __m128i low = _mm_set1_epi32(0xff);
+  __m128i first = _mm_loadu_si128((const __m128i*)p);
+  __m128i second = _mm_loadu_si128((const __m128i*)(p + 16));
+  for (int k = 0; k < 3; ++k)
+    c[k] = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(first, 8 * k), low),
+                           _mm_and_si128(_mm_srli_epi32(second, 8 * k), low));
+}
+
+// (kr * r + kg * g + kb * b + 128) >> 8 of 16 bit lanes, logical shift for
+// luma, whose sums go up to 56228 and only fit unsigned, arithmetic for
+// chroma
+static inline __m128i weighSum(const __m128i c[3], int kr, int kg, int kb,
+                               bool isSigned) {
+  __m128i sum = _mm_add_epi16(_mm_mullo_epi16(c[0], _mm_set1_epi16(kr)),
+                              _mm_mullo_epi16(c[1], _mm_set1_epi16(kg)));
+  sum = _mm_add_epi16(sum, _mm_mullo_epi16(c[2], _mm_set1_epi16(kb)));
+  sum = _mm_add_epi16(sum, _mm_set1_epi16(128));
+  return isSigned ? _mm_srai_epi16(sum, 8) : _mm_srli_epi16(sum, 8);
+}
+#endif
+
+// a pair of rows of RGBA pixels to their luma, and the chroma of every 2x2
+// block (an odd block at the end is its own column). alpha is ignored
+void rgbaToYUV420(const unsigned char *row0, const unsigned char *row1, int n,
+                  unsigned char *y0, unsigned char *y1,
+                  unsigned char *u, unsigned char *v) {
+
+  int i = 0;
+
+#if !defined(SIMD_SCALAR) && defined(__SSE2__)
+  // 8 pixels of both rows at a time, every channel in 16 bit lanes
+  __m128i ones = _mm_set1_epi16(1);
+  __m128i lumaBase = _mm_set1_epi16(16);
+  __m128i chromaBase = _mm_set1_epi16(128);
+  for (; i + 8 <= n; i += 8) {
+    __m128i top[3], bottom[3], block[3];
+    splitChannels(row0 + 4 * i, top);
+    splitChannels(row1 + 4 * i, bottom);
+    __m128i luma0 = _mm_add_epi16(weighSum(top, 66, 129, 25, false), lumaBase);
+    __m128i luma1 = _mm_add_epi16(weighSum(bottom, 66, 129, 25, false), lumaBase);
+    _mm_storel_epi64((__m128i*)(y0 + i), _mm_packus_epi16(luma0, luma0));
+    _mm_storel_epi64((__m128i*)(y1 + i), _mm_packus_epi16(luma1, luma1));
+
+    // the averages of the 4 blocks, in the low 4 lanes
+    for (int k = 0; k < 3; ++k) {
+      __m128i sums = _mm_madd_epi16(_mm_add_epi16(top[k], bottom[k]), ones);
+      sums = _mm_srli_epi32(_mm_add_epi32(sums, _mm_set1_epi32(2)), 2);
+      block[k] = _mm_packs_epi32(sums, sums);
+    }
+    __m128i blue = _mm_add_epi16(weighSum(block, -38, -74, 112, true), chromaBase);
+    __m128i red = _mm_add_epi16(weighSum(block, 112, -94, -18, true), chromaBase);
+    int bytes = _mm_cvtsi128_si32(_mm_packus_epi16(blue, blue));
+    memcpy(u + i / 2, &bytes, 4);
+    bytes = _mm_cvtsi128_si32(_mm_packus_epi16(red, red));
+    memcpy(v + i / 2, &bytes, 4);
+  }
+#endif
+
+  for (; i < n; i += 2) {
+    int last = i + 1 < n ? i + 1 : i;
+    const unsigned char *p[4] = {
+      row0 + 4 * i, row0 + 4 * last, row1 + 4 * i, row1 + 4 * last
+    };
+    y0[i] = lumaOf(p[0][0], p[0][1], p[0][2]);
+    y1[i] = lumaOf(p[2][0], p[2][1], p[2][2]);
+    if (last > i) {
+      y0[last] = lumaOf(p[1][0], p[1][1], p[1][2]);
+      y1[last] = lumaOf(p[3][0], p[3][1], p[3][2]);
+    }
+    int r = (p[0][0] + p[1][0] + p[2][0] + p[3][0] + 2) >> 2;
+    int g = (p[0][1] + p[1][1] + p[2][1] + p[3][1] + 2) >> 2;
+    int b = (p[0][2] + p[1][2] + p[2][2] + p[3][2] + 2) >> 2;
+    u[i / 2] = blueOf(r, g, b);
+    v[i / 2] = redOf(r, g, b);
+  }
+}
@@ -0,0 +1,312 @@
+#include "PngWriter.h"
+#include <algorithm>
+#include <atomic>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+using std::min;
+using std::string;
+using std::vector;
+
+// bytes of filtered rows that get deflated as one slice, pigz uses the same.
+// smaller slices spread better over the threads but every slice ends with a
+// few bytes of padding and starts without any statistics about the data
+#define SLICE_BYTES (128 << 10)
+
+// the dictionary of a slice, as much of the slice before it as deflate can
+// refer back to
+#define DICTIONARY_BYTES (32 << 10)
+
+// rows filtered by a thread at a time
+#define FILTER_GRAIN_BYTES (64 << 10)
+
+static const char *filterNames[] = {
+    "none", "sub", "up", "average", "paeth", "adaptive"
+};
+
+bool parsePngFilter(const string &name, PngFilter &filter) {
+    for (int f = PNG_FILTER_NONE; f <= PNG_FILTER_ADAPTIVE; ++f)
+        if (name == filterNames[f]) {
+            filter = (PngFilter)f;
+            return true;
+        }
+    return false;
+}
+
+static inline unsigned char paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    if (pa <= pb && pa <= pc)
+        return a;
+    return pb <= pc ? b : c;
+}
+
+// filter 'bytes' bytes of a row of 'pixel' bytes per pixel with one of the
+// five png filters, they look at the same channel of the pixel before. the
+// row above is all zeros for the first row
+static void filterRow(int filter, const unsigned char *row,
+                      const unsigned char *above, size_t bytes, size_t pixel,
+                      unsigned char *out) {
+
+    out[0] = filter;
+    out++;
+    switch (filter) {
+    case PNG_FILTER_NONE:
+        memcpy(out, row, bytes);
+        break;
+    case PNG_FILTER_SUB:
+        memcpy(out, row, pixel);
+        for (size_t i = pixel; i < bytes; ++i)
+            out[i] = row[i] - row[i - pixel];
+        break;
+    case PNG_FILTER_UP:
+        for (size_t i = 0; i < bytes; ++i)
+            out[i] = row[i] - above[i];
+        break;
+    case PNG_FILTER_AVERAGE:
+        for (size_t i = 0; i < pixel; ++i)
+            out[i] = row[i] - (above[i] >> 1);
+        for (size_t i = pixel; i < bytes; ++i)
+            out[i] = row[i] - ((row[i - pixel] + above[i]) >> 1);
+        break;
+    case PNG_FILTER_PAETH:
+        for (size_t i = 0; i < pixel; ++i)
+            out[i] = row[i] - paeth(0, above[i], 0);
+        for (size_t i = pixel; i < bytes; ++i)
+            out[i] = row[i] - paeth(row[i - pixel], above[i],
+                                    above[i - pixel]);
+        break;
+    }
+}
+
+// how well a filtered row is going to compress, the smaller the better:
+// the sum of the bytes as signed values, like libpng
+static size_t filterCost(const unsigned char *filtered, size_t bytes) {
+    size_t cost = 0;
+    for (size_t i = 0; i < bytes; ++i)
+        cost += filtered[i] < 128 ? filtered[i] : 256 - filtered[i];
+    return cost;
+}
+
+// the RGB of a row of RGBA pixels
+static void dropAlpha(const unsigned char *rgba, int width, unsigned char *rgb) {
+    for (int x = 0; x < width; ++x, rgba += 4, rgb += 3) {
+        rgb[0] = rgba[0];
+        rgb[1] = rgba[1];
+        rgb[2] = rgba[2];
+    }
+}
+
+static void filterRows(Image *image, PngFilter filter, size_t pixel,
+                       int first, int last, const unsigned char *zeros,
+                       unsigned char *filtered) {
+
+    int width = image->getWidth();
+    size_t bytes = pixel * width;
+    vector<unsigned char> trial, rgb[2];
+    if (filter == PNG_FILTER_ADAPTIVE)
+        trial.resize(bytes + 1);
+    if (pixel == 3) {
+        rgb[0].resize(bytes);
+        rgb[1].resize(bytes);
+        if (first > 0)
+            dropAlpha(image->getRow(first - 1), width, &rgb[(first - 1) & 1][0]);
+    }
+
+    for (int y = first; y < last; ++y) {
+        const unsigned char *row = image->getRow(y);
+        const unsigned char *above = y > 0 ? image->getRow(y - 1) : zeros;
+        if (pixel == 3) {
+            dropAlpha(row, width, &rgb[y & 1][0]);
+            row = &rgb[y & 1][0];
+            above = y > 0 ? &rgb[(y - 1) & 1][0] : zeros;
+        }
+        unsigned char *out = filtered + y * (bytes + 1);
+
+        if (filter != PNG_FILTER_ADAPTIVE) {
+            filterRow(filter, row, above, bytes, pixel, out);
+            continue;
+        }
+        size_t best = 0;
+        for (int f = PNG_FILTER_NONE; f <= PNG_FILTER_PAETH; ++f) {
+            filterRow(f, row, above, bytes, pixel, &trial[0]);
+            size_t cost = filterCost(&trial[1], bytes);
+            if (f == PNG_FILTER_NONE || cost < best) {
+                best = cost;
+                memcpy(out, &trial[0], bytes + 1);
+            }
+        }
+    }
+}
+
+// a raw deflate stream of a slice, which ends on a byte boundary without
+// being the final block unless it's the last slice
+struct Slice {
+    vector<unsigned char> data;
+    unsigned long adler;    // of the uncompressed bytes
+    size_t bytes;
+    bool ok;
+};
+
+static void deflateSlice(const unsigned char *begin, size_t bytes,
+                         const unsigned char *dictionary, size_t dictionaryBytes,
+                         int level, bool last, Slice &slice) {
+
+    slice.bytes = bytes;
+    slice.adler = adler32(adler32(0, Z_NULL, 0), begin, bytes);
+    slice.ok = false;
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (deflateInit2(&stream, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return;
+    if (dictionaryBytes > 0)
+        deflateSetDictionary(&stream, dictionary, dictionaryBytes);
+
+    // the bound is for a finished stream, a sync flush adds an empty stored
+    // block of 5 bytes at most
+    slice.data.resize(deflateBound(&stream, bytes) + 16);
+    stream.next_in = (unsigned char*)begin;
+    stream.avail_in = bytes;
+    int flush = last ? Z_FINISH : Z_SYNC_FLUSH;
+    int status;
+    do {
+        if (stream.total_out == slice.data.size())
+            slice.data.resize(2 * slice.data.size());
+        stream.next_out = &slice.data[stream.total_out];
+        stream.avail_out = slice.data.size() - stream.total_out;
+        status = deflate(&stream, flush);
+    } while (status == Z_OK && (last || stream.avail_out == 0));
+
+    // a flush with nothing left to flush is a buffer error
+    slice.ok = last ? status == Z_STREAM_END :
+                      status == Z_OK || status == Z_BUF_ERROR;
+    slice.data.resize(stream.total_out);
+    deflateEnd(&stream);
+}
+
+static void put32(unsigned char *out, unsigned long value) {
+    out[0] = value >> 24;
+    out[1] = value >> 16;
+    out[2] = value >> 8;
+    out[3] = value;
+}
+
+// a png chunk: length, type, data and the crc of type and data
+static bool writeChunk(FILE *file, const char *type,
+                       const unsigned char *data, size_t bytes) {
+    unsigned char header[8], crc[4];
+    put32(header, bytes);
+    memcpy(header + 4, type, 4);
+    unsigned long sum = crc32(0, header + 4, 4);
+    if (bytes > 0)
+        sum = crc32(sum, data, bytes);
+    put32(crc, sum);
+    // IEND has no data, and no pointer to it either
+    return fwrite(header, 1, 8, file) == 8 &&
+           (bytes == 0 || fwrite(data, 1, bytes, file) == bytes) &&
+           fwrite(crc, 1, 4, file) == 4;
+}
+
+bool writePng(const string &fileName, Image *image,
+              const PngOptions &options, ThreadPool *pool) {
+
+    int width = image->getWidth(), height = image->getHeight();
+    // RGB only if every alpha is 255, the check reads the RGBA rows
+    int grain = std::max(1, (int)(FILTER_GRAIN_BYTES / (4 * (size_t)width)));
+    std::atomic<bool> opaque(options.dropAlpha);
+    auto checkAlpha = [&](int first, int last) {
+        for (int y = first; y < last && opaque; ++y) {
+            const unsigned char *row = image->getRow(y);
+            unsigned char alpha = 0xff;
+            for (int x = 0; x < width; ++x)
+                alpha &= row[4 * x + 3];
+            if (alpha != 0xff)
+                opaque = false;
+        }
+    };
+    if (pool && opaque)
+        pool->parallelFor(0, height, grain, checkAlpha);
+    else if (opaque)
+        checkAlpha(0, height);
+    size_t pixel = opaque ? 3 : 4;
+
+    size_t rowBytes = pixel * width + 1;
+    size_t total = rowBytes * height;
+    grain = std::max(1, (int)(FILTER_GRAIN_BYTES / (pixel * width)));
+
+    // every row filtered on its own, they only look at the unfiltered rows
+    vector<unsigned char> filtered(total), zeros(rowBytes);
+    auto filterBand = [&](int first, int last) {
+        filterRows(image, options.filter, pixel, first, last, &zeros[0],
+                   &filtered[0]);
+    };
+    if (pool)
+        pool->parallelFor(0, height, grain, filterBand);
+    else
+        filterBand(0, height);
+
+    // and deflated in slices, every one with the 32k before it as the
+    // dictionary, so the matches can still reach back across the seams
+    int slices = (int)((total + SLICE_BYTES - 1) / SLICE_BYTES);
+    vector<Slice> deflated(slices);
+    auto deflateSlices = [&](int first, int last) {
+        for (int s = first; s < last; ++s) {
+            size_t begin = (size_t)s * SLICE_BYTES;
+            size_t bytes = min((size_t)SLICE_BYTES, total - begin);
+            size_t dictionary = min((size_t)DICTIONARY_BYTES, begin);
+            deflateSlice(&filtered[begin], bytes, &filtered[begin - dictionary],
+                         dictionary, options.level, s == slices - 1, deflated[s]);
+        }
+    };
+    if (pool)
+        pool->parallelFor(0, slices, 1, deflateSlices);
+    else
+        deflateSlices(0, slices);
+
+    // the zlib header and checksum around the slices, the checksums of the
+    // slices add up to the one of the whole stream
+    unsigned char zlibHeader[2] = { 0x78, 0 };
+    int levelBits = options.level < 2 ? 0 : options.level < 6 ? 1 :
+                    options.level == 6 ? 2 : 3;
+    zlibHeader[1] = levelBits << 6;
+    zlibHeader[1] += 31 - (zlibHeader[0] * 256 + zlibHeader[1]) % 31;
+    unsigned long adler = adler32(0, Z_NULL, 0);
+    for (int s = 0; s < slices; ++s) {
+        if (!deflated[s].ok)
+            return false;
+        adler = adler32_combine(adler, deflated[s].adler, deflated[s].bytes);
+    }
+    // the checksum goes at the end of the last slice
+    vector<unsigned char> &tail = deflated.back().data;
+    tail.resize(tail.size() + 4);
+    put32(&tail[tail.size() - 4], adler);
+
+    FILE *file = fopen(fileName.c_str(), "wb");
+    if (!file)
+        return false;
+
+    static const unsigned char signature[8] = {
+        0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'
+    };
+    // 8 bit RGBA (6) or RGB (2), deflate, adaptive filtering, not interlaced
+    unsigned char header[13] = { 0 };
+    put32(header, width);
+    put32(header + 4, height);
+    header[8] = 8;
+    header[9] = pixel == 4 ? 6 : 2;
+
+    // one IDAT per slice, the chunks of the stream don't have to line up
+    // with the chunks of the file
+    bool ok = fwrite(signature, 1, 8, file) == 8 &&
+              writeChunk(file, "IHDR", header, sizeof(header)) &&
+              writeChunk(file, "IDAT", zlibHeader, 2);
+    for (int s = 0; s < slices && ok; ++s)
+        ok = writeChunk(file, "IDAT", &deflated[s].data[0], deflated[s].data.size());
+    ok = ok && writeChunk(file, "IEND", NULL, 0);
+
+    return fclose(file) == 0 && ok;
+}
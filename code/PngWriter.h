@@ -0,0 +1,45 @@
+// Header file that declares a png writer for the frames of the morph. The
+// rows are filtered and deflated in slices on the threads of a pool, every
+// slice on its own with the end of the slice before it as its dictionary,
+// and the slices are strung together into one zlib stream like pigz does.
+// On a large frame that's several times faster than deflating it all on one
+// thread, and the file is hardly any larger
+
+#ifndef PNGWRITER_H
+#define PNGWRITER_H
+
+#include "Image.h"
+#include "ThreadPool.h"
+#include <string>
+
+// the png filter every row gets, the adaptive one picks for every row the
+// filter with the smallest sum of the filtered bytes (as signed values),
+// like libpng does
+enum PngFilter {
+    PNG_FILTER_NONE,
+    PNG_FILTER_SUB,
+    PNG_FILTER_UP,
+    PNG_FILTER_AVERAGE,
+    PNG_FILTER_PAETH,
+    PNG_FILTER_ADAPTIVE
+};
+
+struct PngOptions {
+    int level;          // zlib compression level, 0 (stored) to 9
+    PngFilter filter;
+    bool dropAlpha;     // write RGB if the image is opaque everywhere
+
+    PngOptions() : level(6), filter(PNG_FILTER_ADAPTIVE), dropAlpha(false) {}
+};
+
+// parse the name of a filter ("none", "sub", "up", "average", "paeth" or
+// "adaptive"), false if there is no such filter
+bool parsePngFilter(const std::string &name, PngFilter &filter);
+
+// write the image (in rows, not tiles) to an RGBA png file, or an RGB one
+// with dropAlpha. pass NULL to run on the calling thread. false if the file
+// couldn't be written
+bool writePng(const std::string &fileName, Image *image,
+              const PngOptions &options, ThreadPool *pool = NULL);
+
+#endif
@@ -0,0 +1,270 @@
+#include "PreparedLines.h"
+#include "Aligned.h"
+#include <math.h>
+#include <algorithm>
+
+// number of float arrays in the block
+#define NUM_ARRAYS 19
+
+// and in the cluster block
+#define NUM_CLUSTER_ARRAYS 15
+
+// width and height of the cells of the grid over the lines, in pixels
+#define GRID_CELL 64
+
+// distance from (x, y) to the segment that starts at (px, py) and goes
+// along (dx, dy)
+static float segmentDistance(float x, float y, float px, float py,
+                             float dx, float dy, float invLenSq) {
+    float pdx = x - px, pdy = y - py;
+    float u = (pdx * dx + pdy * dy) * invLenSq;
+    u = u < 0 ? 0 : (u > 1 ? 1 : u);
+    float ex = pdx - u * dx, ey = pdy - u * dy;
+    return sqrtf(ex * ex + ey * ey);
+}
+
+PreparedLines::PreparedLines() :
+count(0), capacity(0), a(0), b(0), p(0), radius(0), invRadiusSq(0),
+clusterCount(0), block(NULL), clusterBlock(NULL), clusterCapacity(0),
+gridX0(0), gridY0(0), gridColumns(0), gridRows(0)
+{
+    reserve(0);
+    reserveClusters(0);
+}
+
+PreparedLines::~PreparedLines() {
+    alignedFree(block);
+    alignedFree(clusterBlock);
+}
+
+// make room for the given number of lines, every array starts on its own
+// cache line so they can all be read with aligned vector loads
+void PreparedLines::reserve(int lines) {
+
+    if (block && lines <= capacity)
+        return;
+
+    size_t stride = roundUp(lines, CACHE_LINE / sizeof(float));
+    alignedFree(block);
+    block = (float*)alignedAlloc(NUM_ARRAYS * stride * sizeof(float));
+    capacity = stride;
+
+    float **arrays[NUM_ARRAYS] = {
+        &px, &py, &qx, &qy, &dx, &dy, &invLen, &invLenSq, &lenP,
+        &srcPx, &srcPy, &srcDx, &srcDy, &srcInvLen,
+        &dstPx, &dstPy, &dstDx, &dstDy, &dstInvLen
+    };
+    for (int i = 0; i < NUM_ARRAYS; ++i)
+        *arrays[i] = block + i * stride;
+}
+
+void PreparedLines::reserveClusters(int clusters) {
+
+    if (clusterBlock && clusters <= clusterCapacity)
+        return;
+
+    size_t stride = roundUp(clusters, CACHE_LINE / sizeof(float));
+    alignedFree(clusterBlock);
+    clusterBlock = (float*)alignedAlloc(NUM_CLUSTER_ARRAYS * stride * sizeof(float));
+    clusterCapacity = stride;
+
+    float **arrays[NUM_CLUSTER_ARRAYS] = {
+        &clusterX, &clusterY, &clusterMass,
+        &srcXx, &srcXy, &srcX0, &srcYx, &srcYy, &srcY0,
+        &dstXx, &dstXy, &dstX0, &dstYx, &dstYy, &dstY0
+    };
+    for (int i = 0; i < NUM_CLUSTER_ARRAYS; ++i)
+        *arrays[i] = clusterBlock + i * stride;
+}
+
+void PreparedLines::prepare(const std::vector<Line> &sourceLines,
+                            const std::vector<Line> &destLines,
+                            const std::vector<Line> &interLines,
+                            float a_, float b_, float p_, float radius_,
+                            bool grid) {
+
+    count = interLines.size();
+    reserve(count);
+    clusterCount = 0;
+    tree = LineTree();
+
+    a = a_;
+    b = b_;
+    p = p_;
+    radius = radius_;
+    invRadiusSq = radius > 0 ? 1 / (radius * radius) : 0;
+
+    for (int i = 0; i < count; ++i) {
+        const Line &inter = interLines[i];
+        float x = inter.Q.x - inter.P.x;
+        float y = inter.Q.y - inter.P.y;
+        float length = sqrtf(x * x + y * y);
+
+        px[i] = inter.P.x;
+        py[i] = inter.P.y;
+        qx[i] = inter.Q.x;
+        qy[i] = inter.Q.y;
+        dx[i] = x;
+        dy[i] = y;
+        invLen[i] = 1 / length;
+        invLenSq[i] = 1 / (length * length);
+        lenP[i] = p == 0 ? 1 : powf(length, p);
+
+        const Line &src = sourceLines[i];
+        srcPx[i] = src.P.x;
+        srcPy[i] = src.P.y;
+        srcDx[i] = src.Q.x - src.P.x;
+        srcDy[i] = src.Q.y - src.P.y;
+        srcInvLen[i] = 1 / sqrtf(srcDx[i] * srcDx[i] + srcDy[i] * srcDy[i]);
+
+        const Line &dst = destLines[i];
+        dstPx[i] = dst.P.x;
+        dstPy[i] = dst.P.y;
+        dstDx[i] = dst.Q.x - dst.P.x;
+        dstDy[i] = dst.Q.y - dst.P.y;
+        dstInvLen[i] = 1 / sqrtf(dstDx[i] * dstDx[i] + dstDy[i] * dstDy[i]);
+    }
+
+    if (radius > 0 && grid)
+        buildGrid();
+}
+
+void PreparedLines::select(const PreparedLines &all, const int *lines,
+                           int count_) {
+
+    count = count_;
+    reserve(count);
+    clusterCount = 0;
+
+    a = all.a;
+    b = all.b;
+    p = all.p;
+    radius = all.radius;
+    invRadiusSq = all.invRadiusSq;
+
+    // the arrays are laid out the same way in both blocks
+    for (int j = 0; j < NUM_ARRAYS; ++j) {
+        const float *from = all.block + (size_t)j * all.capacity;
+        float *to = block + (size_t)j * capacity;
+        for (int i = 0; i < count; ++i)
+            to[i] = from[lines[i]];
+    }
+}
+
+void PreparedLines::buildTree() {
+    tree.build(*this);
+}
+
+void PreparedLines::selectClusters(const LineTree &from, const int *nodes,
+                                   int count_) {
+
+    clusterCount = count_;
+    reserveClusters(clusterCount);
+
+    for (int i = 0; i < clusterCount; ++i) {
+        const LineCluster &c = from.cluster(nodes[i]);
+        clusterX[i] = c.x;
+        clusterY[i] = c.y;
+        clusterMass[i] = c.mass;
+        srcXx[i] = c.srcXx;
+        srcXy[i] = c.srcXy;
+        srcX0[i] = c.srcX0;
+        srcYx[i] = c.srcYx;
+        srcYy[i] = c.srcYy;
+        srcY0[i] = c.srcY0;
+        dstXx[i] = c.dstXx;
+        dstXy[i] = c.dstXy;
+        dstX0[i] = c.dstX0;
+        dstYx[i] = c.dstYx;
+        dstYy[i] = c.dstYy;
+        dstY0[i] = c.dstY0;
+    }
+}
+
+// bin the lines into the cells of the grid that they reach, the grid covers
+// the bounding box of the lines grown by the radius
+void PreparedLines::buildGrid() {
+
+    cellStart.clear();
+    cellLines.clear();
+    gridColumns = gridRows = 0;
+    if (count == 0)
+        return;
+
+    float minX = HUGE_VALF, minY = HUGE_VALF, maxX = -HUGE_VALF, maxY = -HUGE_VALF;
+    for (int i = 0; i < count; ++i) {
+        minX = fminf(minX, fminf(px[i], qx[i]));
+        minY = fminf(minY, fminf(py[i], qy[i]));
+        maxX = fmaxf(maxX, fmaxf(px[i], qx[i]));
+        maxY = fmaxf(maxY, fmaxf(py[i], qy[i]));
+    }
+    gridX0 = (int)floorf((minX - radius) / GRID_CELL);
+    gridY0 = (int)floorf((minY - radius) / GRID_CELL);
+    gridColumns = (int)floorf((maxX + radius) / GRID_CELL) - gridX0 + 1;
+    gridRows = (int)floorf((maxY + radius) / GRID_CELL) - gridY0 + 1;
+
+    // a line reaches a cell if it is closer than the radius to the center
+    // of the cell, give or take half the diagonal of the cell
+    float reach = radius + 0.5f * sqrtf(2.0f) * GRID_CELL;
+    std::vector<int> cells;     // (cell, line) pairs
+    for (int i = 0; i < count; ++i) {
+        int c0 = (int)floorf((fminf(px[i], qx[i]) - radius) / GRID_CELL) - gridX0;
+        int c1 = (int)floorf((fmaxf(px[i], qx[i]) + radius) / GRID_CELL) - gridX0;
+        int r0 = (int)floorf((fminf(py[i], qy[i]) - radius) / GRID_CELL) - gridY0;
+        int r1 = (int)floorf((fmaxf(py[i], qy[i]) + radius) / GRID_CELL) - gridY0;
+        for (int r = r0; r <= r1; ++r)
+            for (int c = c0; c <= c1; ++c) {
+                float cx = (gridX0 + c + 0.5f) * GRID_CELL;
+                float cy = (gridY0 + r + 0.5f) * GRID_CELL;
+                if (segmentDistance(cx, cy, px[i], py[i], dx[i], dy[i],
+                                    invLenSq[i]) < reach) {
+                    cells.push_back(r * gridColumns + c);
+                    cells.push_back(i);
+                }
+            }
+    }
+
+    // counting sort by cell, the lines of a cell stay in their usual order
+    cellStart.assign(gridColumns * gridRows + 1, 0);
+    for (size_t k = 0; k < cells.size(); k += 2)
+        cellStart[cells[k] + 1]++;
+    for (size_t c = 1; c < cellStart.size(); ++c)
+        cellStart[c] += cellStart[c - 1];
+    cellLines.resize(cells.size() / 2);
+    std::vector<int> next(cellStart.begin(), cellStart.end() - 1);
+    for (size_t k = 0; k < cells.size(); k += 2)
+        cellLines[next[cells[k]]++] = cells[k + 1];
+}
+
+void PreparedLines::linesNear(float x0, float y0, float x1, float y1,
+                              std::vector<int> &found) const {
+
+    found.clear();
+    if (gridColumns == 0)
+        return;
+
+    int c0 = std::max((int)floorf(x0 / GRID_CELL) - gridX0, 0);
+    int c1 = std::min((int)floorf(x1 / GRID_CELL) - gridX0, gridColumns - 1);
+    int r0 = std::max((int)floorf(y0 / GRID_CELL) - gridY0, 0);
+    int r1 = std::min((int)floorf(y1 / GRID_CELL) - gridY0, gridRows - 1);
+
+    for (int r = r0; r <= r1; ++r)
+        for (int c = c0; c <= c1; ++c) {
+            int cell = r * gridColumns + c;
+            found.insert(found.end(), cellLines.begin() + cellStart[cell],
+                         cellLines.begin() + cellStart[cell + 1]);
+        }
+    std::sort(found.begin(), found.end());
+    found.erase(std::unique(found.begin(), found.end()), found.end());
+
+    // keep the ones that get closer than the radius to the rectangle
+    float cx = 0.5f * (x0 + x1), cy = 0.5f * (y0 + y1);
+    float reach = radius + 0.5f * sqrtf((x1 - x0) * (x1 - x0) + (y1 - y0) * (y1 - y0));
+    size_t kept = 0;
+    for (size_t k = 0; k < found.size(); ++k) {
+        int i = found[k];
+        if (segmentDistance(cx, cy, px[i], py[i], dx[i], dy[i], invLenSq[i]) < reach)
+            found[kept++] = i;
+    }
+    found.resize(kept);
+}
@@ -0,0 +1,105 @@
+// Header file that defines the feature lines of a single frame in a form that
+// is ready to be used by the warp. Everything about a line that does not depend
+// on the pixel being warped is computed once per frame and stored in separate,
+// contiguous float arrays (one entry per line), so the per pixel loop only has
+// to do multiply-adds and the arrays can be loaded straight into vector
+// registers
+
+#ifndef PREPAREDLINES_H
+#define PREPAREDLINES_H
+
+#include <vector>
+#include "Line.h"
+#include "LineTree.h"
+
+struct PreparedLines {
+    int count;      // number of feature lines
+    int capacity;   // number of lines the arrays have room for
+
+    // weighting constants
+    float a, b, p;
+
+    // compact weights: how far the lines reach, 0 for the classic weights
+    // that never reach 0
+    float radius;
+    float invRadiusSq;
+
+    // the interpolated lines PQ
+    float *px, *py;      // P
+    float *qx, *qy;      // Q
+    float *dx, *dy;      // direction Q - P
+    float *invLen;       // 1 / |PQ|
+    float *invLenSq;     // 1 / |PQ|^2
+    float *lenP;         // |PQ|^p, all 1 when p is 0
+
+    // the matching lines P'Q' in the source image
+    float *srcPx, *srcPy;
+    float *srcDx, *srcDy;
+    float *srcInvLen;
+
+    // the matching lines P'Q' in the destination image
+    float *dstPx, *dstPy;
+    float *dstDx, *dstDy;
+    float *dstInvLen;
+
+    // clusters of far away lines that stand in for all of their lines with
+    // a single term each, see LineCluster. the lines of a tile get them from
+    // selectClusters(), otherwise there are none
+    int clusterCount;
+    float *clusterX, *clusterY;
+    float *clusterMass;
+    float *srcXx, *srcXy, *srcX0, *srcYx, *srcYy, *srcY0;
+    float *dstXx, *dstXy, *dstX0, *dstYx, *dstYy, *dstY0;
+
+    // the tree over the lines, empty until buildTree()
+    LineTree tree;
+
+    PreparedLines();
+    ~PreparedLines();
+
+    // the arrays are owned by the block, copies would free them twice
+    PreparedLines(const PreparedLines &) = delete;
+    PreparedLines& operator=(const PreparedLines &) = delete;
+
+    // fill in the arrays for the current frame, and the grid when the
+    // weights are compact and grid is set. the lines of a batch are
+    // interleaved and the batch kernel goes over all of them, it has no use
+    // for a grid
+    void prepare(const std::vector<Line> &sourceLines,
+                 const std::vector<Line> &destLines,
+                 const std::vector<Line> &interLines,
+                 float a, float b, float p, float radius, bool grid = true);
+
+    // keep only the given lines of another set, in the given order
+    void select(const PreparedLines &all, const int *lines, int count);
+
+    // build the tree over the lines of the current frame
+    void buildTree();
+
+    // add the given nodes of a tree as clusters
+    void selectClusters(const LineTree &from, const int *nodes, int count);
+
+    // the lines that reach the rectangle [x0, x1] x [y0, y1] (compact
+    // weights only), in their usual order
+    void linesNear(float x0, float y0, float x1, float y1,
+                   std::vector<int> &found) const;
+
+private:
+    float *block;   // one allocation backing all the arrays
+    float *clusterBlock;    // and the cluster arrays
+    int clusterCapacity;
+
+    // uniform grid over the interpolated lines, every cell lists the lines
+    // that reach it: cellLines[cellStart[c] .. cellStart[c + 1])
+    int gridX0, gridY0;             // the first cell
+    int gridColumns, gridRows;
+    std::vector<int> cellStart;
+    std::vector<int> cellLines;
+
+    void buildGrid();
+
+    void reserve(int lines);
+    void reserveClusters(int clusters);
+};
+
+#endif
@@ -0,0 +1,239 @@
+#include "QoiCodec.h"
+#include <algorithm>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+
+using std::string;
+using std::vector;
+
+// the chunks, every one starts with a tag of 2 or 8 bits
+#define QOI_OP_INDEX 0x00   // 00iiiiii, pixel i of the index
+#define QOI_OP_DIFF  0x40   // 01rrggbb, -2..1 off the last pixel
+#define QOI_OP_LUMA  0x80   // 10gggggg rrrrbbbb, green -32..31 off, red and
+                            // blue -8..7 off the green difference
+#define QOI_OP_RUN   0xc0   // 11llllll, the last pixel 1..62 times
+#define QOI_OP_RGB   0xfe   // then r, g, b
+#define QOI_OP_RGBA  0xff   // then r, g, b, a
+#define QOI_MASK     0xc0
+
+#define QOI_MAX_RUN 62
+
+// magic, width, height, channels, colorspace
+#define QOI_HEADER_BYTES 14
+
+// largest image read, like the reference decoder, a corrupt header doesn't
+// get to allocate terabytes
+#define QOI_MAX_PIXELS 400000000
+
+// bytes of the file written at a time
+#define QOI_BUFFER_BYTES (1 << 20)
+
+// the largest chunk, a run ends before the next chunk starts
+#define QOI_MAX_CHUNK 5
+
+static const unsigned char qoiEnd[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+
+// a pixel as r | g << 8 | b << 16 | a << 24, whatever the byte order
+static inline unsigned loadPixel(const unsigned char *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (unsigned)p[3] << 24;
+}
+
+static inline void storePixel(unsigned px, unsigned char *p) {
+    p[0] = px;
+    p[1] = px >> 8;
+    p[2] = px >> 16;
+    p[3] = px >> 24;
+}
+
+static inline int qoiHash(unsigned px) {
+    return ((px & 0xff) * 3 + (px >> 8 & 0xff) * 5 +
+            (px >> 16 & 0xff) * 7 + (px >> 24) * 11) % 64;
+}
+
+static void put32(unsigned char *out, unsigned value) {
+    out[0] = value >> 24;
+    out[1] = value >> 16;
+    out[2] = value >> 8;
+    out[3] = value;
+}
+
+static unsigned get32(const unsigned char *in) {
+    return (unsigned)in[0] << 24 | in[1] << 16 | in[2] << 8 | in[3];
+}
+
+bool writeQoi(const string &fileName, Image *image, bool dropAlpha) {
+
+    int width = image->getWidth(), height = image->getHeight();
+    FILE *file = fopen(fileName.c_str(), "wb");
+    if (!file)
+        return false;
+
+    // a row at most takes every pixel as RGBA, plus the run left over from
+    // the row before. the slack is for that and the end marker
+    size_t bufferBytes = std::max((size_t)QOI_BUFFER_BYTES,
+                                  (size_t)QOI_MAX_CHUNK * width + QOI_HEADER_BYTES);
+    vector<unsigned char> buffer(bufferBytes + 16);
+    unsigned char *out = &buffer[0];
+    size_t n = 0;
+    bool ok = true;
+
+    // the channels are patched once it's known whether there's any alpha
+    memcpy(out, "qoif", 4);
+    put32(out + 4, width);
+    put32(out + 8, height);
+    out[12] = 4;
+    out[13] = 0;    // sRGB with linear alpha
+    n = QOI_HEADER_BYTES;
+
+    unsigned index[64] = { 0 };
+    unsigned previous = 0xff000000;     // opaque black
+    unsigned alpha = 0xff;              // all the alphas and-ed together
+    int run = 0;
+
+    for (int y = 0; y < height && ok; ++y) {
+        if (n + (size_t)QOI_MAX_CHUNK * width > bufferBytes) {
+            ok = fwrite(out, 1, n, file) == n;
+            n = 0;
+        }
+
+        const unsigned char *row = image->getRow(y);
+        for (int x = 0; x < width; ++x) {
+            unsigned px = loadPixel(row + 4 * x);
+            if (px == previous) {
+                if (++run == QOI_MAX_RUN) {
+                    out[n++] = QOI_OP_RUN | (run - 1);
+                    run = 0;
+                }
+                continue;
+            }
+            if (run > 0) {
+                out[n++] = QOI_OP_RUN | (run - 1);
+                run = 0;
+            }
+            alpha &= px >> 24;
+
+            int hash = qoiHash(px);
+            if (index[hash] == px) {
+                out[n++] = QOI_OP_INDEX | hash;
+                previous = px;
+                continue;
+            }
+            index[hash] = px;
+
+            if ((px ^ previous) >> 24 == 0) {
+                // the differences wrap around, like the decoder's sums
+                signed char dr = (px & 0xff) - (previous & 0xff);
+                signed char dg = (px >> 8 & 0xff) - (previous >> 8 & 0xff);
+                signed char db = (px >> 16 & 0xff) - (previous >> 16 & 0xff);
+                signed char drg = dr - dg, dbg = db - dg;
+                if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 &&
+                    db >= -2 && db <= 1)
+                    out[n++] = QOI_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
+                else if (dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 &&
+                         dbg >= -8 && dbg <= 7) {
+                    out[n++] = QOI_OP_LUMA | (dg + 32);
+                    out[n++] = (drg + 8) << 4 | (dbg + 8);
+                }
+                else {
+                    out[n++] = QOI_OP_RGB;
+                    out[n++] = px;
+                    out[n++] = px >> 8;
+                    out[n++] = px >> 16;
+                }
+            }
+            else {
+                out[n++] = QOI_OP_RGBA;
+                storePixel(px, out + n);
+                n += 4;
+            }
+            previous = px;
+        }
+    }
+    if (run > 0)
+        out[n++] = QOI_OP_RUN | (run - 1);
+    memcpy(out + n, qoiEnd, sizeof(qoiEnd));
+    n += sizeof(qoiEnd);
+    ok = ok && fwrite(out, 1, n, file) == n;
+
+    if (ok && dropAlpha && alpha == 0xff) {
+        unsigned char channels = 3;
+        ok = fseek(file, 12, SEEK_SET) == 0 && fwrite(&channels, 1, 1, file) == 1;
+    }
+    return fclose(file) == 0 && ok;
+}
+
+bool readQoi(const string &fileName, Image **image) {
+
+    FILE *file = fopen(fileName.c_str(), "rb");
+    if (!file)
+        return false;
+    vector<unsigned char> data;
+    unsigned char block[1 << 16];
+    size_t count;
+    while ((count = fread(block, 1, sizeof(block), file)) > 0)
+        data.insert(data.end(), block, block + count);
+    fclose(file);
+
+    if (data.size() < QOI_HEADER_BYTES + sizeof(qoiEnd) ||
+        memcmp(&data[0], "qoif", 4) != 0)
+        return false;
+    unsigned width = get32(&data[4]), height = get32(&data[8]);
+    if (width == 0 || height == 0 || height >= QOI_MAX_PIXELS / width)
+        return false;
+
+    *image = new Image(width, height, 4);
+
+    // every chunk is followed by at least the 8 bytes of the end marker, so
+    // a chunk that starts before them can be read whole
+    const unsigned char *p = &data[QOI_HEADER_BYTES];
+    const unsigned char *end = &data[0] + data.size() - sizeof(qoiEnd);
+    unsigned index[64] = { 0 };
+    unsigned px = 0xff000000;
+    int run = 0;
+
+    for (unsigned y = 0; y < height; ++y) {
+        unsigned char *row = (*image)->getRow(y);
+        for (unsigned x = 0; x < width; ++x) {
+            if (run > 0)
+                run--;
+            else if (p < end) {
+                int tag = *p++;
+                if (tag == QOI_OP_RGB) {
+                    px = (px & 0xff000000) | p[0] | p[1] << 8 | p[2] << 16;
+                    p += 3;
+                }
+                else if (tag == QOI_OP_RGBA) {
+                    px = loadPixel(p);
+                    p += 4;
+                }
+                else if ((tag & QOI_MASK) == QOI_OP_INDEX)
+                    px = index[tag];
+                else if ((tag & QOI_MASK) == QOI_OP_DIFF) {
+                    unsigned char r = (px & 0xff) + (tag >> 4 & 3) - 2;
+                    unsigned char g = (px >> 8 & 0xff) + (tag >> 2 & 3) - 2;
+                    unsigned char b = (px >> 16 & 0xff) + (tag & 3) - 2;
+                    px = (px & 0xff000000) | r | g << 8 | b << 16;
+                }
+                else if ((tag & QOI_MASK) == QOI_OP_LUMA) {
+                    int dg = (tag & 0x3f) - 32, rb = *p++;
+                    unsigned char r = (px & 0xff) + dg - 8 + (rb >> 4);
+                    unsigned char g = (px >> 8 & 0xff) + dg;
+                    unsigned char b = (px >> 16 & 0xff) + dg - 8 + (rb & 0xf);
+                    px = (px & 0xff000000) | r | g << 8 | b << 16;
+                }
+                else
+                    run = tag & 0x3f;
+                index[qoiHash(px)] = px;
+            }
+            else {
+                // the chunks ran out before the pixels
+                delete *image;
+                *image = NULL;
+                return false;
+            }
+            storePixel(px, row + 4 * x);
+        }
+    }
+    return true;
+}
@@ -0,0 +1,23 @@
+// Header file that declares a reader and a writer for QOI images (the "Quite
+// OK Image" format, qoiformat.org). It's lossless like png but without any
+// entropy coding, every pixel is a run, an index into the 64 pixels seen last,
+// a small difference to the pixel before or the pixel itself, so it's many
+// times faster to write and read than a png and only somewhat larger. It's
+// meant for the frames of the morph that only feed some later encode
+
+#ifndef QOICODEC_H
+#define QOICODEC_H
+
+#include "Image.h"
+#include <string>
+
+// write the image (in rows, not tiles) to a QOI file. with dropAlpha an
+// image that's opaque everywhere is marked as RGB in the header, the pixels
+// are the same either way. false if the file couldn't be written
+bool writeQoi(const std::string &fileName, Image *image, bool dropAlpha);
+
+// read a QOI file into a new RGBA image, false (and *image NULL) if it
+// couldn't be read, isn't a QOI file, is cut short or is over 400M pixels
+bool readQoi(const std::string &fileName, Image **image);
+
+#endif
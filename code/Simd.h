@@ -0,0 +1,167 @@
+// Header file that wraps the vector registers of the target instruction set in
+// a small float vector type, so the kernels can be written once and work on
+// SIMD_WIDTH values at a time. Falls back to plain floats (SIMD_WIDTH 1) when
+// no vector instruction set is available, or when SIMD_SCALAR is defined.
+//
+// This header is compiled with different instruction sets in different files
+// (see Kernels.inl), so everything in it has internal linkage. Otherwise the
+// linker could pick e.g. the AVX2 copy of an inline function for the SSE2 kernels
+
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <math.h>
+
+#if !defined(SIMD_SCALAR) && (defined(__SSE2__) || defined(__AVX2__))
+#include <immintrin.h>
+#endif
+
+namespace {
+
+#if !defined(SIMD_SCALAR) && defined(__AVX512F__)
+
+#define SIMD_WIDTH 16
+
+struct vmask { __mmask16 m; vmask(__mmask16 m) : m(m) {} };
+
+struct vfloat {
+    __m512 v;
+    vfloat() {}
+    vfloat(__m512 v) : v(v) {}
+    vfloat(float f) : v(_mm512_set1_ps(f)) {}
+};
+
+inline vfloat load(const float *p)          { return _mm512_load_ps(p); }
+inline void store(float *p, vfloat a)       { _mm512_store_ps(p, a.v); }
+inline vfloat ramp(float x) {
+    return _mm512_add_ps(_mm512_set1_ps(x),
+                         _mm512_setr_ps(0, 1, 2, 3, 4, 5, 6, 7,
+                                        8, 9, 10, 11, 12, 13, 14, 15));
+}
+
+inline vfloat operator+(vfloat a, vfloat b) { return _mm512_add_ps(a.v, b.v); }
+inline vfloat operator-(vfloat a, vfloat b) { return _mm512_sub_ps(a.v, b.v); }
+inline vfloat operator*(vfloat a, vfloat b) { return _mm512_mul_ps(a.v, b.v); }
+inline vfloat operator/(vfloat a, vfloat b) { return _mm512_div_ps(a.v, b.v); }
+inline vmask operator<(vfloat a, vfloat b)  { return _mm512_cmp_ps_mask(a.v, b.v, _CMP_LT_OQ); }
+inline vmask operator>(vfloat a, vfloat b)  { return _mm512_cmp_ps_mask(a.v, b.v, _CMP_GT_OQ); }
+inline vmask operator|(vmask a, vmask b)    { return (__mmask16)(a.m | b.m); }
+inline vfloat sqrt(vfloat a)                { return _mm512_sqrt_ps(a.v); }
+inline vfloat abs(vfloat a)                 { return _mm512_abs_ps(a.v); }
+inline vfloat select(vmask m, vfloat a, vfloat b) {
+    return _mm512_mask_blend_ps(m.m, b.v, a.v);
+}
+
+#elif !defined(SIMD_SCALAR) && defined(__AVX2__)
+
+#define SIMD_WIDTH 8
+
+struct vmask { __m256 m; vmask(__m256 m) : m(m) {} };
+
+struct vfloat {
+    __m256 v;
+    vfloat() {}
+    vfloat(__m256 v) : v(v) {}
+    vfloat(float f) : v(_mm256_set1_ps(f)) {}
+};
+
+inline vfloat load(const float *p)          { return _mm256_load_ps(p); }
+inline void store(float *p, vfloat a)       { _mm256_store_ps(p, a.v); }
+// x, x + 1, ..., x + SIMD_WIDTH - 1
+inline vfloat ramp(float x) {
+    return _mm256_add_ps(_mm256_set1_ps(x), _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7));
+}
+
+inline vfloat operator+(vfloat a, vfloat b) { return _mm256_add_ps(a.v, b.v); }
+inline vfloat operator-(vfloat a, vfloat b) { return _mm256_sub_ps(a.v, b.v); }
+inline vfloat operator*(vfloat a, vfloat b) { return _mm256_mul_ps(a.v, b.v); }
+inline vfloat operator/(vfloat a, vfloat b) { return _mm256_div_ps(a.v, b.v); }
+inline vmask operator<(vfloat a, vfloat b)  { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+inline vmask operator>(vfloat a, vfloat b)  { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+inline vmask operator|(vmask a, vmask b)    { return _mm256_or_ps(a.m, b.m); }
+inline vfloat sqrt(vfloat a)                { return _mm256_sqrt_ps(a.v); }
+inline vfloat abs(vfloat a) {
+    return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v);
+}
+// pick a where the mask is set, b everywhere else
+inline vfloat select(vmask m, vfloat a, vfloat b) {
+    return _mm256_blendv_ps(b.v, a.v, m.m);
+}
+
+#elif !defined(SIMD_SCALAR) && defined(__SSE2__)
+
+#define SIMD_WIDTH 4
+
+struct vmask { __m128 m; vmask(__m128 m) : m(m) {} };
+
+struct vfloat {
+    __m128 v;
+    vfloat() {}
+    vfloat(__m128 v) : v(v) {}
+    vfloat(float f) : v(_mm_set1_ps(f)) {}
+};
+
+inline vfloat load(const float *p)          { return _mm_load_ps(p); }
+inline void store(float *p, vfloat a)       { _mm_store_ps(p, a.v); }
+inline vfloat ramp(float x) {
+    return _mm_add_ps(_mm_set1_ps(x), _mm_setr_ps(0, 1, 2, 3));
+}
+
+inline vfloat operator+(vfloat a, vfloat b) { return _mm_add_ps(a.v, b.v); }
+inline vfloat operator-(vfloat a, vfloat b) { return _mm_sub_ps(a.v, b.v); }
+inline vfloat operator*(vfloat a, vfloat b) { return _mm_mul_ps(a.v, b.v); }
+inline vfloat operator/(vfloat a, vfloat b) { return _mm_div_ps(a.v, b.v); }
+inline vmask operator<(vfloat a, vfloat b)  { return _mm_cmplt_ps(a.v, b.v); }
+inline vmask operator>(vfloat a, vfloat b)  { return _mm_cmpgt_ps(a.v, b.v); }
+inline vmask operator|(vmask a, vmask b)    { return _mm_or_ps(a.m, b.m); }
+inline vfloat sqrt(vfloat a)                { return _mm_sqrt_ps(a.v); }
+inline vfloat abs(vfloat a) {
+    return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v);
+}
+inline vfloat select(vmask m, vfloat a, vfloat b) {
+    return _mm_or_ps(_mm_and_ps(m.m, a.v), _mm_andnot_ps(m.m, b.v));
+}
+
+#else
+
+#define SIMD_WIDTH 1
+
+struct vmask { bool m; vmask(bool m) : m(m) {} };
+
+struct vfloat {
+    float v;
+    vfloat() {}
+    vfloat(float f) : v(f) {}
+};
+
+inline vfloat load(const float *p)          { return *p; }
+inline void store(float *p, vfloat a)       { *p = a.v; }
+inline vfloat ramp(float x)                 { return x; }
+
+inline vfloat operator+(vfloat a, vfloat b) { return a.v + b.v; }
+inline vfloat operator-(vfloat a, vfloat b) { return a.v - b.v; }
+inline vfloat operator*(vfloat a, vfloat b) { return a.v * b.v; }
+inline vfloat operator/(vfloat a, vfloat b) { return a.v / b.v; }
+inline vmask operator<(vfloat a, vfloat b)  { return a.v < b.v; }
+inline vmask operator>(vfloat a, vfloat b)  { return a.v > b.v; }
+inline vmask operator|(vmask a, vmask b)    { return a.m || b.m; }
+inline vfloat sqrt(vfloat a)                { return sqrtf(a.v); }
+inline vfloat abs(vfloat a)                 { return fabsf(a.v); }
+inline vfloat select(vmask m, vfloat a, vfloat b) { return m.m ? a : b; }
+
+#endif
+
+inline vfloat& operator+=(vfloat &a, vfloat b) { a = a + b; return a; }
+
+// x^e for every lane. there is no vector pow, so this goes through powf
+inline vfloat pow(vfloat x, float e) {
+    alignas(64) float lanes[SIMD_WIDTH];
+    store(lanes, x);
+    for (int i = 0; i < SIMD_WIDTH; ++i)
+        lanes[i] = powf(lanes[i], e);
+    return load(lanes);
+}
+
+} // namespace
+
+#endif
@@ -0,0 +1,292 @@
+#include "Simplify.h"
+#include "Aligned.h"
+#include "Kernels.h"
+#include "PreparedLines.h"
+#include "Warp.h"
+#include <algorithm>
+#include <math.h>
+
+using std::min;
+using std::max;
+using std::vector;
+
+// distance between the sample points of the grid, in pixels
+#define SAMPLE_SPACING 16
+
+// the warp is checked at the alphas 0, 1/4, ..., 1
+#define NUM_ALPHAS 5
+
+// two lines are a candidate pair when they are at most this sine of an angle
+// apart, and the shorter one is at most this fraction of the length of the
+// longer one away from it, sideways and along it
+#define MAX_SINE 0.2f
+#define MAX_OFFSET 0.2f
+
+static float dot(vec2 u, vec2 v) { return u.x * v.x + u.y * v.y; }
+static float cross(vec2 u, vec2 v) { return u.x * v.y - u.y * v.x; }
+static float length(vec2 u) { return sqrtf(dot(u, u)); }
+
+namespace {
+
+// warps a grid of points over the image with a set of lines, at every alpha
+class SampleGrid {
+private:
+        float *block;
+        WarpParameters parameters;
+        PreparedLines prepared;
+        vector<Line> interLines;
+public:
+        int count;      // number of points, padded to a multiple of 16
+        float *x, *y;
+
+        SampleGrid(int width, int height, const WarpParameters &parameters);
+        ~SampleGrid();
+
+        // the points are owned by the block, copies would free them twice
+        SampleGrid(const SampleGrid &) = delete;
+        SampleGrid& operator=(const SampleGrid &) = delete;
+
+        // NUM_ALPHAS * COMPONENTS rows of count floats each
+        size_t size() const { return (size_t)NUM_ALPHAS * COMPONENTS * count; }
+
+        void warp(const vector<Line> &sourceLines, const vector<Line> &destLines,
+                  float *warped);
+};
+
+SampleGrid::SampleGrid(int width, int height,
+                       const WarpParameters &parameters) :
+parameters(parameters)
+{
+    int columns = (width - 1) / SAMPLE_SPACING + 1;
+    int rows = (height - 1) / SAMPLE_SPACING + 1;
+    count = roundUp(columns * rows, 16);
+
+    block = (float*)alignedAlloc(2 * (size_t)count * sizeof(float));
+    x = block;
+    y = block + count;
+
+    // the padding repeats the last point
+    for (int k = 0; k < count; ++k) {
+        int i = min(k, columns * rows - 1);
+        x[k] = min(i % columns * SAMPLE_SPACING, width - 1);
+        y[k] = min(i / columns * SAMPLE_SPACING, height - 1);
+    }
+}
+
+SampleGrid::~SampleGrid() {
+    alignedFree(block);
+}
+
+void SampleGrid::warp(const vector<Line> &sourceLines,
+                      const vector<Line> &destLines, float *warped) {
+
+    interLines.resize(sourceLines.size());
+    for (int i = 0; i < NUM_ALPHAS; ++i) {
+        float alpha = i / (float)(NUM_ALPHAS - 1);
+        interpolateLines(sourceLines, destLines, interLines, alpha);
+        prepared.prepare(sourceLines, destLines, interLines, parameters.a,
+                         parameters.b, parameters.p, parameters.radius);
+
+        float *out = warped + (size_t)i * COMPONENTS * count;
+        getKernels()->warpPoints(prepared, x, y, count, out, out + count,
+                                 out + 2 * count, out + 3 * count);
+    }
+}
+
+// a line of the pair in both images, the second line is flipped when it
+// points the other way
+struct PairLines {
+    vec2 ends[2][4];    // P and Q of the first line then of the second one
+
+    PairLines(const Line &src1, const Line &dst1,
+              const Line &src2, const Line &dst2, bool flip) {
+        const Line *lines[2][2] = { { &src1, &src2 }, { &dst1, &dst2 } };
+        for (int image = 0; image < 2; ++image) {
+            ends[image][0] = lines[image][0]->P;
+            ends[image][1] = lines[image][0]->Q;
+            ends[image][2] = flip ? lines[image][1]->Q : lines[image][1]->P;
+            ends[image][3] = flip ? lines[image][1]->P : lines[image][1]->Q;
+        }
+    }
+
+    // how far the lines are from being one in the given image, relative to
+    // the longer one. negative if they aren't a candidate pair there
+    float offset(int image) const {
+        const vec2 *e = ends[image];
+        vec2 d1 = e[1] - e[0], d2 = e[3] - e[2];
+        float l1 = length(d1), l2 = length(d2);
+        if (l1 == 0 || l2 == 0 || dot(d1, d2) <= 0 ||
+            fabsf(cross(d1, d2)) > MAX_SINE * l1 * l2)
+            return -1;
+
+        // the shorter line wrt to the longer one
+        const vec2 *longer = l1 >= l2 ? e : e + 2;
+        const vec2 *shorter = l1 >= l2 ? e + 2 : e;
+        vec2 d = longer[1] - longer[0];
+        float l = max(l1, l2);
+        float side = 0, first = HUGE_VALF, last = -HUGE_VALF;
+        for (int k = 0; k < 2; ++k) {
+            vec2 w = shorter[k] - longer[0];
+            side = max(side, fabsf(cross(d, w)) / l);
+            first = min(first, dot(d, w) / l);
+            last = max(last, dot(d, w) / l);
+        }
+        float gap = max(max(first - l, -last), 0.0f);
+        if (side > MAX_OFFSET * l || gap > MAX_OFFSET * l)
+            return -1;
+        return (side + gap) / l;
+    }
+
+    // one line through the end points of both lines in the given image, from
+    // the end point that comes first along them to the one that comes last.
+    // the same end points are used in both images, so they still match
+    Line merge(int image, int start, int end) const {
+        const vec2 *e = ends[image];
+        vec2 center = 0.25f * (e[0] + e[1] + e[2] + e[3]);
+        vec2 d = (e[1] - e[0]) + (e[3] - e[2]);
+        d = d * (1 / length(d));
+        return Line(center + dot(e[start] - center, d) * d,
+                    center + dot(e[end] - center, d) * d);
+    }
+
+    // the first and the last end point along the lines in the source image
+    void span(int &start, int &end) const {
+        vec2 d = (ends[0][1] - ends[0][0]) + (ends[0][3] - ends[0][2]);
+        start = end = 0;
+        for (int k = 1; k < 4; ++k) {
+            if (dot(ends[0][k], d) < dot(ends[0][start], d))
+                start = k;
+            if (dot(ends[0][k], d) > dot(ends[0][end], d))
+                end = k;
+        }
+    }
+};
+
+struct Candidate {
+    int first, second;
+    bool flip;
+    float offset;
+
+    bool operator<(const Candidate &c) const { return offset < c.offset; }
+};
+
+} // namespace
+
+// the pairs of lines that could be one, the closest ones first
+static void findCandidates(const vector<Line> &sourceLines,
+                           const vector<Line> &destLines,
+                           const vector<int> &alive,
+                           vector<Candidate> &candidates) {
+
+    candidates.clear();
+    for (size_t i = 0; i < alive.size(); ++i)
+        for (size_t j = i + 1; j < alive.size(); ++j) {
+            int first = alive[i], second = alive[j];
+            vec2 d1 = sourceLines[first].Q - sourceLines[first].P;
+            vec2 d2 = sourceLines[second].Q - sourceLines[second].P;
+            bool flip = dot(d1, d2) < 0;
+            PairLines pair(sourceLines[first], destLines[first],
+                           sourceLines[second], destLines[second], flip);
+
+            float src = pair.offset(0), dst = pair.offset(1);
+            if (src >= 0 && dst >= 0) {
+                Candidate c = { first, second, flip, src + dst };
+                candidates.push_back(c);
+            }
+        }
+    std::sort(candidates.begin(), candidates.end());
+}
+
+float simplifyLines(vector<Line> &sourceLines, vector<Line> &destLines,
+                    const WarpParameters &parameters,
+                    int width, int height, float tolerance) {
+
+    if (sourceLines.size() < 2)
+        return 0;
+
+    SampleGrid grid(width, height, parameters);
+    float *reference = (float*)alignedAlloc(grid.size() * sizeof(float));
+    float *warped = (float*)alignedAlloc(grid.size() * sizeof(float));
+    grid.warp(sourceLines, destLines, reference);
+
+    // the lines that are left, and a trial set of them with one pair changed
+    vector<Line> source = sourceLines, dest = destLines;
+    vector<int> alive(sourceLines.size());
+    for (size_t i = 0; i < alive.size(); ++i)
+        alive[i] = i;
+    vector<Line> trialSource, trialDest;
+    vector<Candidate> candidates;
+    float error = 0;
+
+    // merging two lines can make a candidate pair of the result and a
+    // third line, so keep going until nothing changes
+    bool changed = true;
+    while (changed && alive.size() > 1) {
+        changed = false;
+        findCandidates(source, dest, alive, candidates);
+        vector<char> touched(source.size(), 0);
+
+        for (size_t c = 0; c < candidates.size(); ++c) {
+            const Candidate &pair = candidates[c];
+            if (touched[pair.first] || touched[pair.second])
+                continue;
+
+            PairLines lines(source[pair.first], dest[pair.first],
+                            source[pair.second], dest[pair.second], pair.flip);
+            int start, end;
+            lines.span(start, end);
+
+            // merge them into one, or else drop the shorter one
+            Line mergedSource = lines.merge(0, start, end);
+            Line mergedDest = lines.merge(1, start, end);
+            vec2 d1 = source[pair.first].Q - source[pair.first].P;
+            vec2 d2 = source[pair.second].Q - source[pair.second].P;
+            int shorter = length(d1) < length(d2) ? pair.first : pair.second;
+
+            for (int attempt = 0; attempt < 2; ++attempt) {
+                trialSource.clear();
+                trialDest.clear();
+                for (size_t k = 0; k < alive.size(); ++k) {
+                    int i = alive[k];
+                    if (attempt == 0 && i == pair.first) {
+                        trialSource.push_back(mergedSource);
+                        trialDest.push_back(mergedDest);
+                    }
+                    else if (attempt == 0 ? i != pair.second : i != shorter) {
+                        trialSource.push_back(source[i]);
+                        trialDest.push_back(dest[i]);
+                    }
+                }
+
+                grid.warp(trialSource, trialDest, warped);
+                float change = 0;
+                for (size_t k = 0; k < grid.size(); ++k)
+                    change = max(change, fabsf(warped[k] - reference[k]));
+                if (!(change <= tolerance))
+                    continue;
+
+                int removed = attempt == 0 ? pair.second : shorter;
+                if (attempt == 0) {
+                    source[pair.first] = mergedSource;
+                    dest[pair.first] = mergedDest;
+                }
+                alive.erase(std::find(alive.begin(), alive.end(), removed));
+                touched[pair.first] = touched[pair.second] = 1;
+                error = change;
+                changed = true;
+                break;
+            }
+        }
+    }
+
+    sourceLines.clear();
+    destLines.clear();
+    for (size_t k = 0; k < alive.size(); ++k) {
+        sourceLines.push_back(source[alive[k]]);
+        destLines.push_back(dest[alive[k]]);
+    }
+
+    alignedFree(reference);
+    alignedFree(warped);
+    return error;
+}
@@ -0,0 +1,30 @@
+// Header file that declares the simplification of a set of feature lines.
+// Hand-clicked rigs often have pairs of lines that are nearly collinear and
+// overlap or almost touch, in both images. Every line costs a full pass over
+// the pixels, so such pairs are merged into one line, or the shorter line is
+// dropped, as long as the warp stays within a given number of pixels of the
+// warp with all the original lines
+
+#ifndef SIMPLIFY_H
+#define SIMPLIFY_H
+
+#include <vector>
+#include "Line.h"
+
+// weighting constants of the warp the lines are simplified for, as in
+// PreparedLines::prepare()
+struct WarpParameters {
+    float a, b, p;
+    float radius;
+};
+
+// simplify sourceLines and destLines together for images of the given size.
+// the warp is checked at a grid of sample points over the image and at a few
+// alphas between the destination and the source, it never moves by more than
+// tolerance pixels. returns the largest change of the warp, in pixels
+float simplifyLines(std::vector<Line> &sourceLines,
+                    std::vector<Line> &destLines,
+                    const WarpParameters &parameters,
+                    int width, int height, float tolerance);
+
+#endif
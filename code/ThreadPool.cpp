@@ -0,0 +1,108 @@
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+
+// a single parallelFor call, lives on the stack of the calling thread
+struct ThreadPool::Job {
+    int last, grain;
+    const std::function<void(int, int)> *fn;
+    std::atomic<int> next;  // first item of the next unclaimed chunk
+    int users;              // threads inside runChunks, guarded by the pool lock
+};
+
+ThreadPool::ThreadPool(int threads) : stopping(false)
+{
+    if (threads <= 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    // the thread calling parallelFor always helps out, so we need one less
+    for (int i = 1; i < threads; ++i)
+        workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    for (size_t i = 0; i < workers.size(); ++i)
+        workers[i].join();
+}
+
+// claim chunks of the job until there are none left
+void ThreadPool::runChunks(Job *job) {
+
+    int begin;
+    while ((begin = job->next.fetch_add(job->grain)) < job->last) {
+        int end = std::min(begin + job->grain, job->last);
+        (*job->fn)(begin, end);
+    }
+
+    std::unique_lock<std::mutex> guard(lock);
+    // nothing left to hand out, make sure nobody else picks the job up
+    for (std::deque<Job*>::iterator it = jobs.begin(); it != jobs.end(); ++it) {
+        if (*it == job) {
+            jobs.erase(it);
+            break;
+        }
+    }
+    job->users--;
+    if (job->users == 0)
+        finished.notify_all();
+}
+
+void ThreadPool::workerLoop() {
+
+    std::unique_lock<std::mutex> guard(lock);
+    while (true) {
+        while (!stopping && jobs.empty())
+            wake.wait(guard);
+        if (stopping)
+            return;
+
+        Job *job = jobs.front();
+        job->users++;
+
+        guard.unlock();
+        runChunks(job);
+        guard.lock();
+    }
+}
+
+void ThreadPool::parallelFor(int first, int last, int grain,
+                             const std::function<void(int, int)> &fn) {
+
+    if (first >= last)
+        return;
+    if (grain < 1)
+        grain = 1;
+
+    // nothing to share, skip the queue altogether
+    if (workers.empty() || last - first <= grain) {
+        for (int begin = first; begin < last; begin += grain)
+            fn(begin, std::min(begin + grain, last));
+        return;
+    }
+
+    Job job;
+    job.last = last;
+    job.grain = grain;
+    job.fn = &fn;
+    job.next = first;
+    job.users = 1;  // that's us
+
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        jobs.push_back(&job);
+    }
+    wake.notify_all();
+
+    runChunks(&job);
+
+    // wait for the workers that are still busy with one of our chunks
+    std::unique_lock<std::mutex> guard(lock);
+    while (job.users > 0)
+        finished.wait(guard);
+}
@@ -0,0 +1,45 @@
+// Header file that defines a small reusable pool of worker threads.
+// Work is described as a range of integers that gets chopped into chunks,
+// the workers (and the calling thread) keep grabbing chunks until the whole
+// range has been processed
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+class ThreadPool {
+private:
+        struct Job;
+
+        std::vector<std::thread> workers;
+        std::deque<Job*> jobs;      // jobs that still have chunks to hand out
+        std::mutex lock;
+        std::condition_variable wake;      // signalled when a job is queued
+        std::condition_variable finished;  // signalled when a job is released
+        bool stopping;
+
+        void workerLoop();
+        void runChunks(Job *job);
+public:
+        // threads <= 0 means one thread per core, the calling thread counts
+        // as one of them
+        explicit ThreadPool(int threads);
+        ~ThreadPool();
+
+        // number of threads that take part in a parallelFor
+        int size() { return (int)workers.size() + 1; }
+
+        // call fn(begin, end) for every chunk of at most 'grain' items in
+        // [first, last). returns once all the chunks are done. safe to call
+        // from several threads at the same time
+        void parallelFor(int first, int last, int grain,
+                         const std::function<void(int, int)> &fn);
+};
+
+#endif
@@ -0,0 +1,683 @@
+#include "Warp.h"
+#include "Kernels.h"
+#include "Aligned.h"
+#include "Mesh.h"
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+using std::min;
+using std::max;
+
+// number of rows the exact engine warps at a time
+#define EXACT_BAND_ROWS 8
+
+// number of rows of lattice cells the adaptive engine warps at a time
+#define ADAPTIVE_BAND_CELLS 4
+
+// width and height of the tiles that get their own list of lines
+#define TILE_SIZE 64
+
+// points every cell is checked at: the midpoints of its top, left, right and
+// bottom edge and its center
+#define PROBES 5
+
+// room for the probes of the four quarters of a cell, they share 4 of them
+#define REFINE_POINTS 16
+
+WarpField::WarpField(int width, int rows) :
+width(width), rows(rows)
+{
+    stride = roundUp(width, 16);
+    block = (float*)alignedAlloc((size_t)COMPONENTS * rows * stride * sizeof(float));
+    srcX = block;
+    srcY = srcX + (size_t)rows * stride;
+    dstX = srcY + (size_t)rows * stride;
+    dstY = dstX + (size_t)rows * stride;
+}
+
+WarpField::~WarpField() {
+    alignedFree(block);
+}
+
+// whether far away lines are summed up by cluster
+static bool useTree(const PreparedLines &lines, const WarpOptions &options) {
+    return options.treeTheta > 0 && !lines.tree.empty();
+}
+
+// whether every tile gets its own list of lines
+static bool tiled(const PreparedLines &lines, const WarpOptions &options) {
+    return lines.radius > 0 || useTree(lines, options) || options.cullEpsilon > 0;
+}
+
+int warpBandRows(const PreparedLines &lines, const WarpOptions &options) {
+    if (options.engine == MESH_WARP)
+        return MESH_BAND_ROWS;
+
+    // square tiles when the lines are picked per tile, they have the
+    // tightest bounds
+    int rows = tiled(lines, options) ? TILE_SIZE : EXACT_BAND_ROWS;
+
+    // a few rows of cells, so they can share their edges. all of them are
+    // powers of 2, so a band is always made of whole lattice cells
+    if (options.engine == ADAPTIVE_WARP)
+        return max(options.gridSize * ADAPTIVE_BAND_CELLS, rows);
+    return rows;
+}
+
+namespace {
+
+// the warped coordinates of a single point
+struct Warped {
+    float c[COMPONENTS];
+};
+
+// points that are sent through the warpPoints kernel in one go, kept in
+// storage for (2 + COMPONENTS) * capacity floats that belongs to the caller
+class PointBatch {
+public:
+        float *x, *y;
+        float *out[COMPONENTS];
+        int count;
+
+        // capacity has to be a multiple of 16
+        PointBatch(float *storage, int capacity) : count(0) {
+            x = storage;
+            y = x + capacity;
+            for (int c = 0; c < COMPONENTS; ++c)
+                out[c] = y + (c + 1) * capacity;
+        }
+
+        int add(float px, float py) {
+            x[count] = px;
+            y[count] = py;
+            return count++;
+        }
+
+        void warp(const MorphKernels *kernels, const PreparedLines &lines) {
+            // the kernel works on whole vectors, fill up the last one with
+            // copies of a real point
+            int padded = roundUp(count, 16);
+            for (int i = count; i < padded; ++i) {
+                x[i] = x[0];
+                y[i] = y[0];
+            }
+            kernels->warpPoints(lines, x, y, count,
+                                out[0], out[1], out[2], out[3]);
+        }
+
+        Warped get(int i) const {
+            Warped w;
+            for (int c = 0; c < COMPONENTS; ++c)
+                w.c[c] = out[c][i];
+            return w;
+        }
+};
+
+// fill o[0 .. N) with start, start + step, ... a trip count known at compile
+// time lets the compiler turn this into vector stores
+template <int N>
+void rampRow(float *o, float start, float step) {
+    for (int k = 0; k < N; ++k)
+        o[k] = start + step * k;
+}
+
+void rampRow(float *o, float start, float step, int n) {
+    switch (n) {
+    case 4: rampRow<4>(o, start, step); break;
+    case 8: rampRow<8>(o, start, step); break;
+    case 16: rampRow<16>(o, start, step); break;
+    case 32: rampRow<32>(o, start, step); break;
+    case 64: rampRow<64>(o, start, step); break;
+    default:
+        for (int k = 0; k < n; ++k)
+            o[k] = start + step * k;
+    }
+}
+
+// Adaptive evaluation of the cells of one band. A cell of the lattice is
+// described by its top left corner, its size and the warped coordinates at
+// its four corners (top left, top right, bottom left, bottom right). The
+// midpoints of its edges and its center are warped exactly as well and
+// compared to what bilinear interpolation of the corners would put there. If
+// they all agree to within the tolerance the whole cell is interpolated,
+// otherwise it gets split into four and every quarter is checked the same way,
+// down to single pixels which are the corners themselves. The probes of a cell
+// are exactly the corners its quarters need, and neighbouring cells share
+// their edges, so no point is warped twice
+struct AdaptiveBand {
+    const MorphKernels *kernels;
+    const PreparedLines &lines;
+    float tolerance;
+    int x0, xEnd, y0, yEnd; // the band covers [x0, xEnd) x [y0, yEnd)
+    WarpField &field;
+
+    int gridSize;
+    int cells;          // lattice cells across the band
+    float *lattice;     // storage for the points of a row of cells
+
+    // the lattice of the current row of cells: the corners and the midpoints
+    // along its top and bottom edge, the midpoints of the vertical edges and
+    // the centers of the cells
+    std::vector<Warped> top, topMid, bottom, bottomMid, side, center;
+
+    AdaptiveBand(const PreparedLines &lines, const WarpOptions &options,
+                 int x0, int xEnd, int y0, int yEnd, WarpField &field) :
+    kernels(getKernels()), lines(lines), tolerance(options.tolerance),
+    x0(x0), xEnd(xEnd), y0(y0), yEnd(yEnd), field(field),
+    gridSize(options.gridSize)
+    {
+        cells = (xEnd - x0 + gridSize - 1) / gridSize;
+        lattice = (float*)alignedAlloc((2 + COMPONENTS) * latticeCapacity() *
+                                       sizeof(float));
+        top.resize(cells + 1);
+        bottom.resize(cells + 1);
+        side.resize(cells + 1);
+        topMid.resize(cells);
+        bottomMid.resize(cells);
+        center.resize(cells);
+    }
+
+    ~AdaptiveBand() {
+        alignedFree(lattice);
+    }
+
+    // both edges of a row of cells, the vertical midpoints and the centers
+    int latticeCapacity() const {
+        return roundUp(6 * cells + 3, 16);
+    }
+
+    bool inside(int x, int y) const {
+        return x < xEnd && y < yEnd;
+    }
+
+    void store(int x, int y, const Warped &w) {
+        size_t i = (size_t)(y - y0) * field.stride + x;
+        field.srcX[i] = w.c[0];
+        field.srcY[i] = w.c[1];
+        field.dstX[i] = w.c[2];
+        field.dstY[i] = w.c[3];
+    }
+
+    // bilinearly interpolate the corners over the pixels of the cell
+    void interpolate(int x, int y, int size, const Warped corners[4]) {
+        int columns = min(x + size, xEnd) - x;
+        int yLast = min(y + size, yEnd);
+        float scale = 1.0f / size;
+
+        for (int py = y; py < yLast; ++py) {
+            float fy = (py - y) * scale;
+            size_t row = (size_t)(py - y0) * field.stride + x;
+            float *out[COMPONENTS] = {
+                field.srcX + row, field.srcY + row, field.dstX + row, field.dstY + row
+            };
+            for (int c = 0; c < COMPONENTS; ++c) {
+                float left = corners[0].c[c] + (corners[2].c[c] - corners[0].c[c]) * fy;
+                float right = corners[1].c[c] + (corners[3].c[c] - corners[1].c[c]) * fy;
+                rampRow(out[c], left, (right - left) * scale, columns);
+            }
+        }
+    }
+
+    // largest difference between the probes and what bilinear interpolation
+    // of the corners puts there
+    static float error(const Warped corners[4], const Warped probes[PROBES]) {
+        float worst = 0;
+        for (int c = 0; c < COMPONENTS; ++c) {
+            float c0 = corners[0].c[c], c1 = corners[1].c[c];
+            float c2 = corners[2].c[c], c3 = corners[3].c[c];
+            float expected[PROBES] = {
+                0.5f * (c0 + c1), 0.5f * (c0 + c2),
+                0.5f * (c1 + c3), 0.5f * (c2 + c3),
+                0.25f * (c0 + c1 + c2 + c3)
+            };
+            for (int k = 0; k < PROBES; ++k)
+                worst = max(worst, fabsf(probes[k].c[c] - expected[k]));
+        }
+        return worst;
+    }
+
+    void refine(int x, int y, int size, const Warped corners[4],
+                const Warped probes[PROBES]) {
+
+        if (size == 1) {
+            store(x, y, corners[0]);
+            return;
+        }
+
+        if (error(corners, probes) <= tolerance) {
+            interpolate(x, y, size, corners);
+            return;
+        }
+
+        // the probes of this cell are the corners of its quarters. unless
+        // they are single pixels the quarters need probes of their own:
+        // the midpoints of the 3 x 2 horizontal and 2 x 3 vertical edges and
+        // the 4 centers
+        int half = size / 2, quarter = half / 2;
+        alignas(CACHE_LINE) float storage[(2 + COMPONENTS) * REFINE_POINTS];
+        PointBatch batch(storage, REFINE_POINTS);
+        if (half > 1) {
+            for (int r = 0; r < 3; ++r)
+                for (int c = 0; c < 2; ++c)
+                    batch.add(x + c * half + quarter, y + r * half);
+            for (int r = 0; r < 2; ++r)
+                for (int c = 0; c < 3; ++c)
+                    batch.add(x + c * half, y + r * half + quarter);
+            for (int r = 0; r < 2; ++r)
+                for (int c = 0; c < 2; ++c)
+                    batch.add(x + c * half + quarter, y + r * half + quarter);
+            batch.warp(kernels, lines);
+        }
+
+        const Warped &t = probes[0], &l = probes[1], &r = probes[2];
+        const Warped &b = probes[3], &m = probes[4];
+        Warped quarters[4][4] = {
+            { corners[0], t, l, m },
+            { t, corners[1], m, r },
+            { l, m, corners[2], b },
+            { m, r, b, corners[3] }
+        };
+
+        for (int q = 0; q < 4; ++q) {
+            int qr = q / 2, qc = q % 2;
+            int qx = x + qc * half;
+            int qy = y + qr * half;
+            if (!inside(qx, qy))
+                continue;
+            Warped quarterProbes[PROBES];
+            if (half > 1) {
+                quarterProbes[0] = batch.get(qr * 2 + qc);
+                quarterProbes[1] = batch.get(6 + qr * 3 + qc);
+                quarterProbes[2] = batch.get(6 + qr * 3 + qc + 1);
+                quarterProbes[3] = batch.get((qr + 1) * 2 + qc);
+                quarterProbes[4] = batch.get(12 + qr * 2 + qc);
+            }
+            refine(qx, qy, half, quarters[q], quarterProbes);
+        }
+    }
+
+    // warp the lattice cells with their top edge on row y. the top edge is
+    // the bottom edge of the previous row of cells unless this is the first
+    void cellRow(int y, bool first) {
+        int size = gridSize, half = size / 2;
+
+        PointBatch batch(lattice, latticeCapacity());
+        if (first) {
+            for (int i = 0; i <= cells; ++i)
+                batch.add(x0 + i * size, y);
+            for (int i = 0; i < cells; ++i)
+                batch.add(x0 + i * size + half, y);
+        }
+        for (int i = 0; i <= cells; ++i)
+            batch.add(x0 + i * size, y + size);
+        for (int i = 0; i < cells; ++i)
+            batch.add(x0 + i * size + half, y + size);
+        for (int i = 0; i <= cells; ++i)
+            batch.add(x0 + i * size, y + half);
+        for (int i = 0; i < cells; ++i)
+            batch.add(x0 + i * size + half, y + half);
+        batch.warp(kernels, lines);
+
+        int k = 0;
+        if (first) {
+            for (int i = 0; i <= cells; ++i)
+                top[i] = batch.get(k++);
+            for (int i = 0; i < cells; ++i)
+                topMid[i] = batch.get(k++);
+        }
+        for (int i = 0; i <= cells; ++i)
+            bottom[i] = batch.get(k++);
+        for (int i = 0; i < cells; ++i)
+            bottomMid[i] = batch.get(k++);
+        for (int i = 0; i <= cells; ++i)
+            side[i] = batch.get(k++);
+        for (int i = 0; i < cells; ++i)
+            center[i] = batch.get(k++);
+
+        for (int i = 0; i < cells; ++i) {
+            Warped corners[4] = { top[i], top[i + 1], bottom[i], bottom[i + 1] };
+            Warped probes[PROBES] = {
+                topMid[i], side[i], side[i + 1], bottomMid[i], center[i]
+            };
+            refine(x0 + i * size, y, size, corners, probes);
+        }
+
+        top.swap(bottom);
+        topMid.swap(bottomMid);
+    }
+};
+
+// Bounds on the weight of every line over the pixels of a tile. The
+// distance to a segment grows by at most the distance moved, so it is at
+// least the distance from the center of the tile minus half its diagonal.
+// It is also convex, so the largest one is at one of the corners. The lines
+// with the smallest upper bounds are dropped for as long as their upper
+// bounds add up to at most epsilon times the sum of the lower bounds of all
+// the lines, then no pixel of the tile loses more than that fraction of its
+// total weight
+class LineCuller {
+private:
+        const PreparedLines &lines;
+        float epsilon;
+        std::vector<float> upper;
+        std::vector<int> order, keep;
+
+        static float distance(float x, float y, float px, float py,
+                              float dx, float dy, float invLenSq) {
+            float pdx = x - px, pdy = y - py;
+            float u = (pdx * dx + pdy * dy) * invLenSq;
+            u = min(max(u, 0.0f), 1.0f);
+            float ex = pdx - u * dx, ey = pdy - u * dy;
+            return sqrtf(ex * ex + ey * ey);
+        }
+public:
+        LineCuller(const PreparedLines &lines, float epsilon) :
+        lines(lines), epsilon(epsilon),
+        upper(lines.count), order(lines.count), keep(lines.count) {}
+
+        // the lines that matter for the pixels [x0, x1] x [y0, y1], either
+        // all the lines or the ones that got copied into tile
+        const PreparedLines& cull(int x0, int y0, int x1, int y1,
+                                  PreparedLines &tile) {
+            float cx = 0.5f * (x0 + x1), cy = 0.5f * (y0 + y1);
+            float radius = 0.5f * sqrtf((float)(x1 - x0) * (x1 - x0) +
+                                        (float)(y1 - y0) * (y1 - y0));
+            float corners[4][2] = { {(float)x0, (float)y0}, {(float)x1, (float)y0},
+                                    {(float)x0, (float)y1}, {(float)x1, (float)y1} };
+            float total = 0, smallest = HUGE_VALF;
+
+            for (int i = 0; i < lines.count; ++i) {
+                float px = lines.px[i], py = lines.py[i];
+                float dx = lines.dx[i], dy = lines.dy[i];
+                float invLenSq = lines.invLenSq[i];
+
+                float nearest = max(distance(cx, cy, px, py, dx, dy, invLenSq) -
+                                    radius, 0.0f);
+                float farthest = 0;
+                for (int c = 0; c < 4; ++c)
+                    farthest = max(farthest, distance(corners[c][0], corners[c][1],
+                                                      px, py, dx, dy, invLenSq));
+
+                float strength = lines.p == 0 ? 1 : lines.lenP[i];
+                upper[i] = powf(strength / (lines.a + nearest), lines.b);
+                total += powf(strength / (lines.a + farthest), lines.b);
+                smallest = min(smallest, upper[i]);
+                order[i] = i;
+            }
+
+            // nothing can be dropped, which happens a lot when the weights
+            // fall off slowly
+            float budget = epsilon * total, dropped = 0;
+            if (smallest > budget)
+                return lines;
+
+            std::sort(order.begin(), order.end(),
+                      [&](int i, int j) { return upper[i] < upper[j]; });
+
+            int first = 0;
+            while (first < lines.count - 1 &&
+                   dropped + upper[order[first]] <= budget)
+                dropped += upper[order[first++]];
+
+            // the remaining lines in their usual order, so the sums come out
+            // the same way as without culling
+            int count = 0;
+            for (int i = 0; i < lines.count; ++i)
+                keep[i] = 0;
+            for (int k = first; k < lines.count; ++k)
+                keep[order[k]] = 1;
+            for (int i = 0; i < lines.count; ++i)
+                if (keep[i])
+                    order[count++] = i;
+            tile.select(lines, order.data(), count);
+            return tile;
+        }
+};
+
+} // namespace
+
+// warp the pixels [x0, x1) x [y0, y0 + rows) with the given lines
+static void warpTile(const PreparedLines &lines, const WarpOptions &options,
+                     int x0, int x1, int y0, int rows, WarpField &field) {
+
+    if (options.engine == ADAPTIVE_WARP) {
+        AdaptiveBand band(lines, options, x0, x1, y0, y0 + rows, field);
+        for (int y = y0; y < y0 + rows; y += options.gridSize)
+            band.cellRow(y, y == y0);
+        return;
+    }
+
+    const MorphKernels *kernels = getKernels();
+    for (int r = 0; r < rows; ++r) {
+        size_t row = (size_t)r * field.stride + x0;
+        kernels->warpRow(lines, y0 + r, x0, x1 - x0,
+                         field.srcX + row, field.srcY + row,
+                         field.dstX + row, field.dstY + row);
+    }
+}
+
+void warpBand(const PreparedLines &lines, const WarpOptions &options,
+              int y0, int rows, WarpField &field) {
+    warpColumns(lines, options, 0, field.width, y0, rows, field);
+}
+
+void warpColumns(const PreparedLines &lines, const WarpOptions &options,
+                 int x0, int x1, int y0, int rows, WarpField &field) {
+
+    // the mesh always does the whole band
+    if (options.engine == MESH_WARP) {
+        options.mesh->warpBand(y0, rows, field);
+        return;
+    }
+
+    if (!tiled(lines, options)) {
+        warpTile(lines, options, x0, x1, y0, rows, field);
+        return;
+    }
+
+    // the tiles are whole lattice cells wide, and go from left to right so
+    // the padding the exact kernels write past the end of a tile gets
+    // overwritten by the next one
+    int columns = TILE_SIZE;
+    if (options.engine == ADAPTIVE_WARP)
+        columns = max(columns, options.gridSize);
+
+    // compact weights know exactly which lines reach a tile, the classic
+    // ones can only be summed up by cluster or culled approximately
+    bool compact = lines.radius > 0;
+    bool tree = !compact && useTree(lines, options);
+    LineCuller culler(lines, tree ? 0 : options.cullEpsilon);
+    PreparedLines tileLines;
+    std::vector<int> nearby, clusters;
+    for (int tx0 = x0; tx0 < x1; tx0 += columns) {
+        int tx1 = min(tx0 + columns, x1);
+
+        // the adaptive engine also warps the far corners of the cells on
+        // the edges of the tile, which can stick out of it
+        int xLast = tx1 - 1, yLast = y0 + rows - 1;
+        if (options.engine == ADAPTIVE_WARP) {
+            xLast = tx0 + roundUp(tx1 - tx0, options.gridSize);
+            yLast = y0 + roundUp(rows, options.gridSize);
+        }
+
+        const PreparedLines *kept = &lines;
+        if (compact) {
+            lines.linesNear(tx0, y0, xLast, yLast, nearby);
+            if ((int)nearby.size() < lines.count) {
+                tileLines.select(lines, nearby.data(), nearby.size());
+                kept = &tileLines;
+            }
+        }
+        else if (tree) {
+            lines.tree.gather(tx0, y0, xLast, yLast, options.treeTheta,
+                              nearby, clusters);
+            if (!clusters.empty()) {
+                tileLines.select(lines, nearby.data(), nearby.size());
+                tileLines.selectClusters(lines.tree, clusters.data(),
+                                         clusters.size());
+                kept = &tileLines;
+            }
+        }
+        else
+            kept = &culler.cull(tx0, y0, xLast, yLast, tileLines);
+
+        warpTile(*kept, options, tx0, tx1, y0, rows, field);
+    }
+}
+
+void warpFrame(const PreparedLines &lines, const WarpOptions &options,
+               WarpField &frame, ThreadPool *pool) {
+
+    int bandRows = warpBandRows(lines, options);
+    auto warpRows = [&](int first, int last) {
+        WarpField band(frame.width, bandRows);
+        for (int y0 = first; y0 < last; y0 += bandRows) {
+            int rows = min(bandRows, last - y0);
+            warpBand(lines, options, y0, rows, band);
+
+            // both have the same stride, the rows are copied padding and all
+            size_t bytes = (size_t)rows * band.stride * sizeof(float);
+            size_t offset = (size_t)y0 * frame.stride;
+            memcpy(frame.srcX + offset, band.srcX, bytes);
+            memcpy(frame.srcY + offset, band.srcY, bytes);
+            memcpy(frame.dstX + offset, band.dstX, bytes);
+            memcpy(frame.dstY + offset, band.dstY, bytes);
+        }
+    };
+
+    if (pool)
+        pool->parallelFor(0, frame.rows, bandRows, warpRows);
+    else
+        warpRows(0, frame.rows);
+}
+
+int driftingTiles(const WarpField &from, const WarpField &to, float t,
+                  const WarpField &exact, float tolerance,
+                  std::vector<char> &drifting) {
+
+    int columns = (exact.width + KEYFRAME_TILE - 1) / KEYFRAME_TILE;
+    int rows = (exact.rows + KEYFRAME_TILE - 1) / KEYFRAME_TILE;
+    std::vector<float> error(columns * rows, 0.0f);
+
+    const float *a[COMPONENTS] = { from.srcX, from.srcY, from.dstX, from.dstY };
+    const float *b[COMPONENTS] = { to.srcX, to.srcY, to.dstX, to.dstY };
+    const float *e[COMPONENTS] = { exact.srcX, exact.srcY, exact.dstX, exact.dstY };
+    for (int c = 0; c < COMPONENTS; ++c)
+        for (int y = 0; y < exact.rows; ++y) {
+            size_t row = (size_t)y * exact.stride;
+            float *tiles = &error[y / KEYFRAME_TILE * columns];
+            for (int x = 0; x < exact.width; ++x) {
+                // the same as lerpRow()
+                float lerp = a[c][row + x] + (b[c][row + x] - a[c][row + x]) * t;
+                float &tile = tiles[x / KEYFRAME_TILE];
+                tile = max(tile, fabsf(lerp - e[c][row + x]));
+            }
+        }
+
+    int count = 0;
+    drifting.resize(error.size());
+    for (size_t k = 0; k < error.size(); ++k) {
+        drifting[k] = !(error[k] <= tolerance);
+        count += drifting[k];
+    }
+    return count;
+}
+
+void interpolateFrame(const WarpField &from, const WarpField &to, float t,
+                      const PreparedLines &lines, const WarpOptions &options,
+                      const std::vector<char> &drifting, WarpField &frame,
+                      ThreadPool *pool) {
+
+    const MorphKernels *kernels = getKernels();
+    int columns = (frame.width + KEYFRAME_TILE - 1) / KEYFRAME_TILE;
+
+    // one row of tiles at a time
+    auto interpolateRows = [&](int first, int last) {
+        WarpField band(frame.width, KEYFRAME_TILE);
+        const float *a[COMPONENTS] = { from.srcX, from.srcY, from.dstX, from.dstY };
+        const float *b[COMPONENTS] = { to.srcX, to.srcY, to.dstX, to.dstY };
+        float *out[COMPONENTS] = { frame.srcX, frame.srcY, frame.dstX, frame.dstY };
+        const float *exact[COMPONENTS] = { band.srcX, band.srcY, band.dstX, band.dstY };
+
+        for (int y0 = first; y0 < last; y0 += KEYFRAME_TILE) {
+            int rows = min(KEYFRAME_TILE, last - y0);
+            for (int c = 0; c < COMPONENTS; ++c)
+                for (int r = 0; r < rows; ++r) {
+                    size_t row = (size_t)(y0 + r) * frame.stride;
+                    kernels->lerpRow(a[c] + row, b[c] + row, frame.width, t,
+                                     out[c] + row);
+                }
+
+            // runs of drifting tiles are warped in one go
+            const char *tiles = &drifting[y0 / KEYFRAME_TILE * columns];
+            for (int tx = 0; tx < columns; ) {
+                if (!tiles[tx]) {
+                    tx++;
+                    continue;
+                }
+                int end = tx;
+                while (end < columns && tiles[end])
+                    end++;
+                int x0 = tx * KEYFRAME_TILE;
+                int x1 = min(end * KEYFRAME_TILE, frame.width);
+                warpColumns(lines, options, x0, x1, y0, rows, band);
+
+                for (int c = 0; c < COMPONENTS; ++c)
+                    for (int r = 0; r < rows; ++r)
+                        memcpy(out[c] + (size_t)(y0 + r) * frame.stride + x0,
+                               exact[c] + (size_t)r * band.stride + x0,
+                               (x1 - x0) * sizeof(float));
+                tx = end;
+            }
+        }
+    };
+
+    if (pool)
+        pool->parallelFor(0, frame.rows, KEYFRAME_TILE, interpolateRows);
+    else
+        interpolateRows(0, frame.rows);
+}
+
+// largest difference of the rows [0, rows) of field to the plain sum over all
+// the lines at the rows [y0, y0 + rows), exact is a row of scratch space
+static float bandError(const PreparedLines &lines, const WarpField &field,
+                       int y0, int rows, WarpField &exact) {
+    const MorphKernels *kernels = getKernels();
+    int width = field.width;
+    float error = 0;
+
+    for (int r = 0; r < rows; ++r) {
+        kernels->warpRow(lines, y0 + r, 0, width, exact.srcX, exact.srcY,
+                         exact.dstX, exact.dstY);
+        size_t row = (size_t)r * field.stride;
+        for (int x = 0; x < width; ++x) {
+            error = max(error, fabsf(field.srcX[row + x] - exact.srcX[x]));
+            error = max(error, fabsf(field.srcY[row + x] - exact.srcY[x]));
+            error = max(error, fabsf(field.dstX[row + x] - exact.dstX[x]));
+            error = max(error, fabsf(field.dstY[row + x] - exact.dstY[x]));
+        }
+    }
+    return error;
+}
+
+float warpError(const PreparedLines &lines, const WarpOptions &options,
+                int width, int height) {
+
+    int bandRows = warpBandRows(lines, options);
+    WarpField field(width, bandRows), exact(width, 1);
+    float error = 0;
+
+    for (int y0 = 0; y0 < height; y0 += bandRows) {
+        int rows = min(bandRows, height - y0);
+        warpBand(lines, options, y0, rows, field);
+        error = max(error, bandError(lines, field, y0, rows, exact));
+    }
+    return error;
+}
+
+float fieldError(const PreparedLines &lines, const WarpField &field) {
+    WarpField exact(field.width, 1);
+    return bandError(lines, field, 0, field.rows, exact);
+}
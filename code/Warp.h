@@ -0,0 +1,123 @@
+// Header file that declares how the warp of a frame is evaluated. The exact
+// engine runs the warp kernels on every pixel, the adaptive one only on a
+// coarse lattice and interpolates the warped coordinates in between, wherever
+// the field is smooth enough for that. Either way every tile of pixels can
+// get its own list of lines: with compact weights the ones that reach it,
+// otherwise the nearby ones plus clusters standing in for the far away ones,
+// or the ones left after culling those that can hardly pull on it. The mesh
+// engine doesn't use the field of the lines at all, see WarpMesh
+
+#ifndef WARP_H
+#define WARP_H
+
+#include <vector>
+#include "PreparedLines.h"
+#include "ThreadPool.h"
+
+// the warped coordinates have 4 components: srcX, srcY, dstX, dstY
+#define COMPONENTS 4
+
+enum WarpEngine {
+    EXACT_WARP,     // every pixel is warped on its own
+    ADAPTIVE_WARP,  // sparse lattice, refined where the field isn't smooth
+    MESH_WARP       // affine per triangle of a mesh, see WarpMesh
+};
+
+class WarpMesh;
+
+struct WarpOptions {
+    WarpEngine engine;
+    int gridSize;       // adaptive: spacing of the lattice, a power of 2 >= 2
+    float tolerance;    // adaptive: largest error at the probes, in pixels
+
+    // lines whose weights add up to less than this fraction of the total
+    // weight anywhere in a tile are left out of that tile, 0 keeps them all.
+    // not used with compact weights, they drop exactly the lines that can't
+    // reach a tile anyway
+    float cullEpsilon;
+
+    // clusters of lines that are farther away from a tile than their radius
+    // over this are summed up as one term each, 0 warps every line on its
+    // own. needs PreparedLines::buildTree(), not used with compact weights
+    // and takes the place of culling
+    float treeTheta;
+
+    // mesh: the triangles, prepared for the current frame. the lines and
+    // all the options above are not used then
+    const WarpMesh *mesh;
+
+    WarpOptions() :
+    engine(EXACT_WARP), gridSize(8), tolerance(0.1f), cullEpsilon(0),
+    treeTheta(0), mesh(NULL) {}
+};
+
+// warped coordinates of a band of rows, one row after the other. every row
+// is aligned to a cache line and padded for the vector kernels
+class WarpField {
+private:
+        float *block;
+public:
+        int width, rows;
+        int stride;     // floats from one row to the next
+        float *srcX, *srcY;     // the pixels mapped onto the source
+        float *dstX, *dstY;     // and onto the destination
+
+        WarpField(int width, int rows);
+        ~WarpField();
+
+        // the rows are owned by the block, copies would free them twice
+        WarpField(const WarpField &) = delete;
+        WarpField& operator=(const WarpField &) = delete;
+};
+
+// number of rows warped at a time, the bands handed to warpBand() have to
+// start at a multiple of it
+int warpBandRows(const PreparedLines &lines, const WarpOptions &options);
+
+// warp the rows [y0, y0 + rows) of an image that is field.width pixels wide,
+// row r of the field ends up with the coordinates of row y0 + r
+void warpBand(const PreparedLines &lines, const WarpOptions &options,
+              int y0, int rows, WarpField &field);
+
+// warp only the pixels [x0, x1) of the rows [y0, y0 + rows), x0 has to be a
+// multiple of 64. the mesh engine warps the whole band regardless
+void warpColumns(const PreparedLines &lines, const WarpOptions &options,
+                 int x0, int x1, int y0, int rows, WarpField &field);
+
+// warp all the rows of an image into a field that is as tall as the image,
+// the bands are handed out to the threads of the pool (NULL runs them on
+// the calling thread)
+void warpFrame(const PreparedLines &lines, const WarpOptions &options,
+               WarpField &frame, ThreadPool *pool = NULL);
+
+// Keyframes: the warp of the frames between two keyframes is interpolated
+// from theirs, checked in square tiles of this many pixels
+#define KEYFRAME_TILE 64
+
+// mark the tiles where the field interpolated between from and to at t is
+// more than tolerance pixels off exact, all three fields as tall as the
+// image. returns how many there are
+int driftingTiles(const WarpField &from, const WarpField &to, float t,
+                  const WarpField &exact, float tolerance,
+                  std::vector<char> &drifting);
+
+// the field of a whole frame interpolated between two keyframes,
+// from + (to - from) t, except for the drifting tiles which are warped with
+// the lines of the frame
+void interpolateFrame(const WarpField &from, const WarpField &to, float t,
+                      const PreparedLines &lines, const WarpOptions &options,
+                      const std::vector<char> &drifting, WarpField &frame,
+                      ThreadPool *pool = NULL);
+
+// largest difference between the coordinates warped with the given options
+// and those of the plain sum over all the lines, anywhere in an image of the
+// given size. as slow as warping everything twice, it is for checking the
+// approximations
+float warpError(const PreparedLines &lines, const WarpOptions &options,
+                int width, int height);
+
+// the same for the field of a whole frame, however it was made (e.g. by
+// interpolateFrame)
+float fieldError(const PreparedLines &lines, const WarpField &field);
+
+#endif
@@ -0,0 +1,499 @@
+// Warp kernels (Beier-Neely field warping), included by Kernels.inl
+
+// The weight of a line is (|PQ|^p / (a + dist))^b. Raising to the power b is
+// by far the most expensive part of it, so the kernels are specialized on b:
+// small integer powers become a chain of multiplies, anything else goes
+// through powf with the real float value
+
+template <int B>
+struct ConstantExponent {
+  static vfloat raise(vfloat base, float) {
+    return ConstantExponent<B - 1>::raise(base, 0) * base;
+  }
+};
+
+template <>
+struct ConstantExponent<1> {
+  static vfloat raise(vfloat base, float) { return base; }
+};
+
+struct FloatExponent {
+  static vfloat raise(vfloat base, float b) { return pow(base, b); }
+};
+
+// With compact weights the classic weight of a line is scaled by
+// (1 - d^2 / r^2)^2 within the radius r and is 0 beyond it, so it fades out
+// smoothly and lines that are farther away than r can be skipped exactly
+inline vfloat window(vfloat distSq, vfloat invRadiusSq) {
+  vfloat one = 1.0f, zero = 0.0f;
+  vfloat t = distSq * invRadiusSq;
+  vfloat falloff = one - t;
+  return select(t < one, falloff * falloff, zero);
+}
+
+// the scanline kernel works on spans of this many steps of SIMD_WIDTH pixels,
+// everything that is advanced incrementally gets set up from scratch again
+// at the start of every span
+#define SCANLINE_STEPS 16
+#define SCANLINE_SPAN (SCANLINE_STEPS * SIMD_WIDTH)
+
+// map the pixels (x0, y) ... (x0 + n - 1, y) wrt to the interpolated lines to
+// the corresponding points wrt to the source lines (srcX, srcY) and wrt to
+// the destination lines (dstX, dstY), SIMD_WIDTH pixels at a time.
+//
+// Along a row u, v, the x distances to P and Q and the corresponding points
+// on P'Q' are all affine in x. So instead of working them out from scratch for
+// every pixel, they are set up once per line at the start of a span of the
+// row and then advanced with one add per step. The squared distances to the
+// end points are quadratic in x, but they are built from the x distances with
+// a multiply-add rather than forward differences: the latter lose all their
+// precision next to the end points, where the weights are largest. The spans
+// are short enough to keep the rounding errors of the adds in the same
+// ballpark as those of computing everything directly.
+//
+// UseLength is false when p is 0, |PQ|^p is 1 then and drops out of the
+// weight. Compact is true when the weights fade out to 0 at lines.radius
+template <bool UseLength, bool Compact, class Exponent>
+struct RowKernel {
+  typedef void (*Fn)(const PreparedLines &, int, int, int,
+                     float *, float *, float *, float *);
+
+  static void run(const PreparedLines &lines, int y, int x0, int n,
+                  float *srcX, float *srcY, float *dstX, float *dstY) {
+
+    alignas(64) float weightSum[SCANLINE_SPAN];
+
+    vfloat a = lines.a;
+    float b = lines.b;
+    vfloat invRadiusSq = lines.invRadiusSq;
+    vfloat zero = 0.0f, one = 1.0f;
+    // offsets of the lanes from the first pixel of a step, and the step itself
+    vfloat lane = ramp(0);
+    float step = SIMD_WIDTH;
+
+    for (int start = 0; start < n; start += SCANLINE_SPAN) {
+      // the sums are accumulated straight into the output rows
+      int span = n - start < SCANLINE_SPAN ? n - start : SCANLINE_SPAN;
+      float *sx = srcX + start, *sy = srcY + start;
+      float *tx = dstX + start, *ty = dstY + start;
+
+      for (int x = 0; x < span; x += SIMD_WIDTH) {
+        store(sx + x, zero);
+        store(sy + x, zero);
+        store(tx + x, zero);
+        store(ty + x, zero);
+        store(weightSum + x, zero);
+      }
+
+      for (int i = 0; i < lines.count; i++) {
+        // the first pixel of the span, wrt to P and Q of the interpolated line
+        float pdx = x0 + start - lines.px[i], pdy = y - lines.py[i];
+        float qdx = x0 + start - lines.qx[i], qdy = y - lines.qy[i];
+
+        // u and v at the first pixel and how much they change per pixel
+        float u0 = (pdx * lines.dx[i] + pdy * lines.dy[i]) * lines.invLenSq[i];
+        float v0 = (pdx * lines.dy[i] - pdy * lines.dx[i]) * lines.invLen[i];
+        float du = lines.dx[i] * lines.invLenSq[i];
+        float dv = lines.dy[i] * lines.invLen[i];
+
+        vfloat u = vfloat(u0) + lane * vfloat(du);
+        vfloat v = vfloat(v0) + lane * vfloat(dv);
+        vfloat uStep = du * step, vStep = dv * step;
+
+        // x distances to P and Q, the y distances are the same for the whole row
+        vfloat pd = vfloat(pdx) + lane, qd = vfloat(qdx) + lane;
+        vfloat pdySq = pdy * pdy, qdySq = qdy * qdy;
+        vfloat xStep = step;
+
+        // the corresponding points on the source and the destination line,
+        // P' + u P'Q' + v perp(P'Q') / |P'Q'|, and their change per pixel
+        float sdx = lines.srcDx[i], sdy = lines.srcDy[i];
+        float vs0 = v0 * lines.srcInvLen[i], dvs = dv * lines.srcInvLen[i];
+        vfloat srcPx = lines.srcPx[i] + u0 * sdx + vs0 * sdy;
+        vfloat srcPy = lines.srcPy[i] + u0 * sdy - vs0 * sdx;
+        vfloat srcPxStep = du * sdx + dvs * sdy;
+        vfloat srcPyStep = du * sdy - dvs * sdx;
+        srcPx = srcPx + lane * srcPxStep;
+        srcPy = srcPy + lane * srcPyStep;
+        srcPxStep = srcPxStep * vfloat(step);
+        srcPyStep = srcPyStep * vfloat(step);
+
+        float ddx = lines.dstDx[i], ddy = lines.dstDy[i];
+        float vd0 = v0 * lines.dstInvLen[i], dvd = dv * lines.dstInvLen[i];
+        vfloat dstPx = lines.dstPx[i] + u0 * ddx + vd0 * ddy;
+        vfloat dstPy = lines.dstPy[i] + u0 * ddy - vd0 * ddx;
+        vfloat dstPxStep = du * ddx + dvd * ddy;
+        vfloat dstPyStep = du * ddy - dvd * ddx;
+        dstPx = dstPx + lane * dstPxStep;
+        dstPy = dstPy + lane * dstPyStep;
+        dstPxStep = dstPxStep * vfloat(step);
+        dstPyStep = dstPyStep * vfloat(step);
+
+        vfloat strength = UseLength ? vfloat(lines.lenP[i]) : one;
+
+        for (int x = 0; x < span; x += SIMD_WIDTH) {
+          // the shortest distance to the segment PQ, without branching: past
+          // either end it is the distance to that end point, otherwise |v|
+          vmask beforeP = u < zero;
+          vmask pastEnd = beforeP | (u > one);
+          vfloat endDistSq = select(beforeP, pd * pd + pdySq, qd * qd + qdySq);
+          vfloat dist = select(pastEnd, sqrt(endDistSq), abs(v));
+
+          vfloat weight = Exponent::raise(strength / (a + dist), b);
+          if (Compact)
+            weight = weight * window(select(pastEnd, endDistSq, v * v), invRadiusSq);
+
+          store(sx + x, load(sx + x) + srcPx * weight);
+          store(sy + x, load(sy + x) + srcPy * weight);
+          store(tx + x, load(tx + x) + dstPx * weight);
+          store(ty + x, load(ty + x) + dstPy * weight);
+          store(weightSum + x, load(weightSum + x) + weight);
+
+          // on to the next SIMD_WIDTH pixels
+          u += uStep;
+          v += vStep;
+          pd += xStep;
+          qd += xStep;
+          srcPx += srcPxStep;
+          srcPy += srcPyStep;
+          dstPx += dstPxStep;
+          dstPy += dstPyStep;
+        }
+      }
+
+      // the clusters of far away lines, everything is measured from the
+      // center of the cluster and the maps of its lines are summed up already
+      for (int i = 0; i < lines.clusterCount; i++) {
+        float cdx = x0 + start - lines.clusterX[i], cdy = y - lines.clusterY[i];
+        vfloat cd = vfloat(cdx) + lane, cdySq = cdy * cdy;
+        vfloat xStep = step;
+        vfloat mass = lines.clusterMass[i];
+
+        float first = x0 + start;
+        float sxx = lines.srcXx[i], syx = lines.srcYx[i];
+        float dxx = lines.dstXx[i], dyx = lines.dstYx[i];
+        vfloat srcPx = vfloat(sxx * first + lines.srcXy[i] * y + lines.srcX0[i]) + lane * vfloat(sxx);
+        vfloat srcPy = vfloat(syx * first + lines.srcYy[i] * y + lines.srcY0[i]) + lane * vfloat(syx);
+        vfloat dstPx = vfloat(dxx * first + lines.dstXy[i] * y + lines.dstX0[i]) + lane * vfloat(dxx);
+        vfloat dstPy = vfloat(dyx * first + lines.dstYy[i] * y + lines.dstY0[i]) + lane * vfloat(dyx);
+        vfloat srcPxStep = sxx * step, srcPyStep = syx * step;
+        vfloat dstPxStep = dxx * step, dstPyStep = dyx * step;
+
+        for (int x = 0; x < span; x += SIMD_WIDTH) {
+          vfloat weight = Exponent::raise(one / (a + sqrt(cd * cd + cdySq)), b);
+
+          store(sx + x, load(sx + x) + srcPx * weight);
+          store(sy + x, load(sy + x) + srcPy * weight);
+          store(tx + x, load(tx + x) + dstPx * weight);
+          store(ty + x, load(ty + x) + dstPy * weight);
+          store(weightSum + x, load(weightSum + x) + mass * weight);
+
+          cd += xStep;
+          srcPx += srcPxStep;
+          srcPy += srcPyStep;
+          dstPx += dstPxStep;
+          dstPy += dstPyStep;
+        }
+      }
+
+      // average the computed sum values
+      for (int x = 0; x < span; x += SIMD_WIDTH) {
+        vfloat sum = load(weightSum + x);
+        if (Compact) {
+          // no line reaches the pixel, it stays where it is
+          vmask reached = sum > zero;
+          vfloat px = vfloat((float)(x0 + start + x)) + lane, py = (float)y;
+          store(sx + x, select(reached, load(sx + x) / sum, px));
+          store(sy + x, select(reached, load(sy + x) / sum, py));
+          store(tx + x, select(reached, load(tx + x) / sum, px));
+          store(ty + x, select(reached, load(ty + x) / sum, py));
+          continue;
+        }
+        store(sx + x, load(sx + x) / sum);
+        store(sy + x, load(sy + x) / sum);
+        store(tx + x, load(tx + x) / sum);
+        store(ty + x, load(ty + x) / sum);
+      }
+    }
+  }
+};
+
+// map the n points (x[k], y[k]) wrt to the interpolated lines to the
+// corresponding points wrt to the source lines (srcX, srcY) and wrt to the
+// destination lines (dstX, dstY). unlike the rows, the points can be anywhere
+// so everything is computed directly for every point, SIMD_WIDTH at a time
+template <bool UseLength, bool Compact, class Exponent>
+struct PointsKernel {
+  typedef void (*Fn)(const PreparedLines &, const float *, const float *,
+                     int, float *, float *, float *, float *);
+
+  static void run(const PreparedLines &lines, const float *x, const float *y,
+                  int n, float *srcX, float *srcY, float *dstX, float *dstY) {
+
+    vfloat a = lines.a;
+    float b = lines.b;
+    vfloat invRadiusSq = lines.invRadiusSq;
+    vfloat zero = 0.0f, one = 1.0f;
+
+    for (int k = 0; k < n; k += SIMD_WIDTH) {
+      // the input points, wrt to the interLines
+      vfloat inputX = load(x + k);
+      vfloat inputY = load(y + k);
+
+      // weighted sums for the corresponding points in the source and the
+      // destination image
+      vfloat src_x = zero, src_y = zero;
+      vfloat dst_x = zero, dst_y = zero;
+      vfloat weightSum = zero;
+
+      for (int i = 0; i < lines.count; i++) {
+        vfloat dx = lines.dx[i], dy = lines.dy[i];
+
+        vfloat pdx = inputX - vfloat(lines.px[i]);
+        vfloat pdy = inputY - vfloat(lines.py[i]);
+        vfloat u = (pdx * dx + pdy * dy) * vfloat(lines.invLenSq[i]);
+        // cross product between pd and pq
+        vfloat v = (pdx * dy - pdy * dx) * vfloat(lines.invLen[i]);
+
+        // the shortest distance to the segment PQ
+        vfloat qdx = inputX - vfloat(lines.qx[i]);
+        vfloat qdy = inputY - vfloat(lines.qy[i]);
+        vmask beforeP = u < zero;
+        vmask pastEnd = beforeP | (u > one);
+        vfloat endDistSq = select(beforeP, pdx * pdx + pdy * pdy,
+                                           qdx * qdx + qdy * qdy);
+        vfloat dist = select(pastEnd, sqrt(endDistSq), abs(v));
+
+        vfloat strength = UseLength ? vfloat(lines.lenP[i]) : one;
+        vfloat weight = Exponent::raise(strength / (a + dist), b);
+        if (Compact)
+          weight = weight * window(select(pastEnd, endDistSq, v * v), invRadiusSq);
+
+        // corresponding point based on the current source line
+        vfloat vs = v * vfloat(lines.srcInvLen[i]);
+        vfloat sdx = lines.srcDx[i], sdy = lines.srcDy[i];
+        src_x += (vfloat(lines.srcPx[i]) + u * sdx + vs * sdy) * weight;
+        src_y += (vfloat(lines.srcPy[i]) + u * sdy - vs * sdx) * weight;
+
+        // and based on the current destination line
+        vfloat vd = v * vfloat(lines.dstInvLen[i]);
+        vfloat ddx = lines.dstDx[i], ddy = lines.dstDy[i];
+        dst_x += (vfloat(lines.dstPx[i]) + u * ddx + vd * ddy) * weight;
+        dst_y += (vfloat(lines.dstPy[i]) + u * ddy - vd * ddx) * weight;
+
+        weightSum += weight;
+      }
+
+      // the clusters of far away lines, as in RowKernel
+      for (int i = 0; i < lines.clusterCount; i++) {
+        vfloat cdx = inputX - vfloat(lines.clusterX[i]);
+        vfloat cdy = inputY - vfloat(lines.clusterY[i]);
+        vfloat weight = Exponent::raise(one / (a + sqrt(cdx * cdx + cdy * cdy)), b);
+
+        src_x += (inputX * vfloat(lines.srcXx[i]) + inputY * vfloat(lines.srcXy[i]) +
+                  vfloat(lines.srcX0[i])) * weight;
+        src_y += (inputX * vfloat(lines.srcYx[i]) + inputY * vfloat(lines.srcYy[i]) +
+                  vfloat(lines.srcY0[i])) * weight;
+        dst_x += (inputX * vfloat(lines.dstXx[i]) + inputY * vfloat(lines.dstXy[i]) +
+                  vfloat(lines.dstX0[i])) * weight;
+        dst_y += (inputX * vfloat(lines.dstYx[i]) + inputY * vfloat(lines.dstYy[i]) +
+                  vfloat(lines.dstY0[i])) * weight;
+        weightSum += vfloat(lines.clusterMass[i]) * weight;
+      }
+
+      // average the computed sum values, the points no line reaches stay
+      // where they are
+      vfloat sx = src_x / weightSum, sy = src_y / weightSum;
+      vfloat tx = dst_x / weightSum, ty = dst_y / weightSum;
+      if (Compact) {
+        vmask reached = weightSum > zero;
+        sx = select(reached, sx, inputX);
+        sy = select(reached, sy, inputY);
+        tx = select(reached, tx, inputX);
+        ty = select(reached, ty, inputY);
+      }
+      store(srcX + k, sx);
+      store(srcY + k, sy);
+      store(dstX + k, tx);
+      store(dstY + k, ty);
+    }
+  }
+};
+
+// the alpha kernel works on spans of this many pixels of a row
+#define ALPHA_SPAN 64
+
+// map a row of pixels at a batch of alphas, see MorphKernels::warpRowAlphas.
+// The lanes hold the same pixel at SIMD_WIDTH different alphas, so the lines
+// are loaded straight from their interleaved arrays. Otherwise it works like
+// RowKernel: everything that is affine in x is set up once per line at the
+// start of a span and then advanced pixel by pixel, with the sums of every
+// pixel of the span kept in memory
+template <bool UseLength, bool Compact, class Exponent>
+struct AlphasKernel {
+  typedef void (*Fn)(const PreparedLines &, int, int, int, int,
+                     float *, float *, float *, float *, int);
+
+  static void run(const PreparedLines &lines, int alphas, int y, int x0, int n,
+                  float *srcX, float *srcY, float *dstX, float *dstY,
+                  int stride) {
+
+    alignas(64) float sums[5][ALPHA_SPAN * SIMD_WIDTH];
+    float *out[4] = { srcX, srcY, dstX, dstY };
+
+    vfloat a = lines.a;
+    float b = lines.b;
+    vfloat invRadiusSq = lines.invRadiusSq;
+    vfloat zero = 0.0f, one = 1.0f;
+    int count = lines.count / alphas;
+
+    for (int start = 0; start < n; start += ALPHA_SPAN) {
+      int span = n - start < ALPHA_SPAN ? n - start : ALPHA_SPAN;
+      float first = x0 + start;
+
+      for (int k = 0; k < alphas; k += SIMD_WIDTH) {
+        for (int c = 0; c < 5; ++c)
+          for (int x = 0; x < span; ++x)
+            store(sums[c] + x * SIMD_WIDTH, zero);
+
+        for (int i = 0; i < count; i++) {
+          int j = i * alphas + k;
+          vfloat dx = load(lines.dx + j), dy = load(lines.dy + j);
+          vfloat invLen = load(lines.invLen + j);
+
+          // the first pixel of the span, wrt to P and Q
+          vfloat pdx = vfloat(first) - load(lines.px + j);
+          vfloat pdy = vfloat((float)y) - load(lines.py + j);
+          vfloat qdx = vfloat(first) - load(lines.qx + j);
+          vfloat qdy = vfloat((float)y) - load(lines.qy + j);
+          vfloat pdySq = pdy * pdy, qdySq = qdy * qdy;
+
+          // u and v, and how much they change per pixel
+          vfloat du = dx * load(lines.invLenSq + j);
+          vfloat dv = dy * invLen;
+          vfloat u = pdx * du + pdy * dy * load(lines.invLenSq + j);
+          vfloat v = pdx * dv - pdy * dx * invLen;
+
+          // the corresponding points on the source and the destination line
+          vfloat sdx = load(lines.srcDx + j), sdy = load(lines.srcDy + j);
+          vfloat srcInvLen = load(lines.srcInvLen + j);
+          vfloat vs = v * srcInvLen, dvs = dv * srcInvLen;
+          vfloat srcPx = load(lines.srcPx + j) + u * sdx + vs * sdy;
+          vfloat srcPy = load(lines.srcPy + j) + u * sdy - vs * sdx;
+          vfloat srcPxStep = du * sdx + dvs * sdy;
+          vfloat srcPyStep = du * sdy - dvs * sdx;
+
+          vfloat ddx = load(lines.dstDx + j), ddy = load(lines.dstDy + j);
+          vfloat dstInvLen = load(lines.dstInvLen + j);
+          vfloat vd = v * dstInvLen, dvd = dv * dstInvLen;
+          vfloat dstPx = load(lines.dstPx + j) + u * ddx + vd * ddy;
+          vfloat dstPy = load(lines.dstPy + j) + u * ddy - vd * ddx;
+          vfloat dstPxStep = du * ddx + dvd * ddy;
+          vfloat dstPyStep = du * ddy - dvd * ddx;
+
+          vfloat strength = UseLength ? load(lines.lenP + j) : one;
+
+          for (int x = 0; x < span; ++x) {
+            vmask beforeP = u < zero;
+            vmask pastEnd = beforeP | (u > one);
+            vfloat endDistSq = select(beforeP, pdx * pdx + pdySq, qdx * qdx + qdySq);
+            vfloat dist = select(pastEnd, sqrt(endDistSq), abs(v));
+
+            vfloat weight = Exponent::raise(strength / (a + dist), b);
+            if (Compact)
+              weight = weight * window(select(pastEnd, endDistSq, v * v), invRadiusSq);
+
+            float *at = sums[0] + x * SIMD_WIDTH;
+            store(at, load(at) + srcPx * weight);
+            at = sums[1] + x * SIMD_WIDTH;
+            store(at, load(at) + srcPy * weight);
+            at = sums[2] + x * SIMD_WIDTH;
+            store(at, load(at) + dstPx * weight);
+            at = sums[3] + x * SIMD_WIDTH;
+            store(at, load(at) + dstPy * weight);
+            at = sums[4] + x * SIMD_WIDTH;
+            store(at, load(at) + weight);
+
+            // on to the next pixel
+            u += du;
+            v += dv;
+            pdx += one;
+            qdx += one;
+            srcPx += srcPxStep;
+            srcPy += srcPyStep;
+            dstPx += dstPxStep;
+            dstPy += dstPyStep;
+          }
+        }
+
+        // average the sums, and hand every lane to the row of its alpha
+        alignas(64) float lanes[4][SIMD_WIDTH];
+        for (int x = 0; x < span; ++x) {
+          vfloat sum = load(sums[4] + x * SIMD_WIDTH);
+          for (int c = 0; c < 4; ++c) {
+            vfloat value = load(sums[c] + x * SIMD_WIDTH) / sum;
+            if (Compact) {
+              // no line reaches the pixel, it stays where it is
+              vfloat input = c % 2 == 0 ? vfloat(first + x) : vfloat((float)y);
+              value = select(sum > zero, value, input);
+            }
+            store(lanes[c], value);
+          }
+          for (int c = 0; c < 4; ++c)
+            for (int l = 0; l < SIMD_WIDTH; ++l)
+              out[c][(size_t)(k + l) * stride + start + x] = lanes[c][l];
+        }
+      }
+    }
+  }
+};
+
+// pick the instantiation of a kernel for the weighting parameters of the lines
+template <template <bool, bool, class> class Kernel, bool UseLength, bool Compact>
+typename Kernel<UseLength, Compact, FloatExponent>::Fn pickExponent(float b) {
+  if (b == 1)
+    return Kernel<UseLength, Compact, ConstantExponent<1> >::run;
+  if (b == 2)
+    return Kernel<UseLength, Compact, ConstantExponent<2> >::run;
+  if (b == 3)
+    return Kernel<UseLength, Compact, ConstantExponent<3> >::run;
+  return Kernel<UseLength, Compact, FloatExponent>::run;
+}
+
+template <template <bool, bool, class> class Kernel>
+typename Kernel<false, false, FloatExponent>::Fn
+pickKernel(const PreparedLines &lines) {
+  if (lines.radius > 0) {
+    if (lines.p == 0)
+      return pickExponent<Kernel, false, true>(lines.b);
+    return pickExponent<Kernel, true, true>(lines.b);
+  }
+  if (lines.p == 0)
+    return pickExponent<Kernel, false, false>(lines.b);
+  return pickExponent<Kernel, true, false>(lines.b);
+}
+
+void warpRow(const PreparedLines &lines, int y, int x0, int n,
+             float *srcX, float *srcY, float *dstX, float *dstY) {
+  pickKernel<RowKernel>(lines)(lines, y, x0, n, srcX, srcY, dstX, dstY);
+}
+
+void warpPoints(const PreparedLines &lines, const float *x, const float *y,
+                int n, float *srcX, float *srcY, float *dstX, float *dstY) {
+  pickKernel<PointsKernel>(lines)(lines, x, y, n, srcX, srcY, dstX, dstY);
+}
+
+void warpRowAlphas(const PreparedLines &lines, int alphas, int y, int x0,
+                   int n, float *srcX, float *srcY, float *dstX, float *dstY,
+                   int stride) {
+  pickKernel<AlphasKernel>(lines)(lines, alphas, y, x0, n, srcX, srcY,
+                                  dstX, dstY, stride);
+}
+
+void lerpRow(const float *a, const float *b, int n, float t, float *out) {
+  vfloat vt = t;
+  for (int x = 0; x < n; x += SIMD_WIDTH) {
+    vfloat va = load(a + x);
+    store(out + x, va + (load(b + x) - va) * vt);
+  }
+}
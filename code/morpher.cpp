@@ -6,17 +6,43 @@
  #  include <GL/glut.h>
  #endif
 
+#include "FrameStream.h"
+#include "FrameWriter.h"
 #include "Image.h"
+#include "Kernels.h"
+#include "Mesh.h"
+#include "PngWriter.h"
+#include "PreparedLines.h"
+#include "QoiCodec.h"
+#include "Simplify.h"
+#include "ThreadPool.h"
+#include "Warp.h"
 
 #include <stdio.h>
+#include <string.h>
 #include <iostream>
 #include <fstream>
 #include <vector>
 #include <string>
+#include <mutex>
+#include <thread>
 
 #include "glm/vec2.hpp" // glm::vec2
 #include "glm/gtx/transform.hpp"
 
+// frames from the first keyframe to the next one that is tried
+#define KEYFRAME_STEP 8
+
+// most frames morphed in one pass over the pixels
+#define MAX_BATCH_FRAMES 64
+
+// writer threads by default, every one of them keeps two frames around
+#define MAX_WRITERS 4
+
+// largest fraction of the tiles of the frames between two keyframes that
+// get warped exactly, rather than putting the keyframes closer together
+#define KEYFRAME_MAX_DRIFTING 0.25f
+
 #define SUCCESS_CODE 1
 #define FAILURE_CODE 0
 
@@ -32,7 +58,7 @@ enum ImageType {
 };
 
 // all images will have the exact same height and width
-Image *morphedImage = NULL;
+Image *morphedImage = NULL;   // a copy of the last frame, for the 'w' key
 Image *source = NULL;
 Image *destination = NULL;
 Image *toDisplay = NULL;
@@ -43,16 +69,44 @@ vector<vec2> destFeatureLines;
 
 // image name strings
 string sourceImage, destImage, morphedImageName;
+string frameExtension = ".png";  // the format of the frames, .png or .qoi
 string parameterFileName = "";
 float a, b, p;
+float radius = 0;   // compact weights, 0 - the classic ones
+bool checkWarp = false;     // print how far the warp is off the plain sum
+float simplifyTolerance = 0;  // pixels the simplified lines may move the warp
+float keyframeTolerance = 0;  // pixels the interpolated warp may drift, 0 - off
+int batchMegabytes = 0;       // memory for frames morphed together, 0 - off
+bool tiledImages = false;     // keep the source and destination in tiles
+float planarMegapixels = 0;   // largest inputs kept as float planes, 0 - none
+int hugePageMegabytes = 0;    // smallest images put on huge pages, 0 - off
+int writerThreads = 0;        // threads writing frames, 0 - one per core up to 4
+int queueFrames = 0;          // frames waiting for or being written, 0 - 2 per writer
+PngOptions pngOptions;        // deflate level and filter of the frames
+bool dropAlpha = false;       // write opaque frames as RGB
+string streamName = "";       // file, pipe or "-" (stdout) of the frames, empty - one file a frame
+StreamFormat streamFormat = Y4M_STREAM;
+bool rawStream = false;       // stream RGBA rather than y4m to stdout
+int streamRate = 25;          // frames a second of a y4m stream
+FrameStream *frameStream = NULL;
 int frames;
 
+// worker threads shared by every frame of the morph
+ThreadPool *pool = NULL;
+int threads = 0;  // 0 - one thread per core
+
+// instruction set of the kernels, empty - the best one the cpu supports
+string isa = "";
+
+// how the warp of every frame gets evaluated
+WarpOptions warpOptions;
+
 int type;  // type - source or destination?
 
 // always ask user for output image file name
-void writeimage(string outfilename=""){
+void writeimage(Image *image, string outfilename=""){
 
-	if (!morphedImage)
+	if (!image)
 		return;
 
 	if (outfilename.empty()) {
@@ -70,7 +124,7 @@ void writeimage(string outfilename=""){
   // open a file for writing the image. The file header will indicate an image of
   // width w, height h, and 4 channels per pixel (RGBA). All channels will be of
   // type unsigned char
-  ImageSpec spec(morphedImage->getWidth(), morphedImage->getHeight(), 4, TypeDesc::UINT8);
+  ImageSpec spec(image->getWidth(), image->getHeight(), 4, TypeDesc::UINT8);
 
   if(!outfile->open(outfilename, spec)){
     cerr << "Could not open " << outfilename << ", error = " << geterror() << endl;
@@ -79,8 +133,9 @@ void writeimage(string outfilename=""){
   }
 
   // write the image to the file. All channel values in the pixmap are taken to be
-  // unsigned chars
-  if(!outfile->write_image(TypeDesc::UINT8, morphedImage->getPixmap())){
+  // unsigned chars, the rows are padded to a cache line
+  if(!outfile->write_image(TypeDesc::UINT8, image->getPixmap(), AutoStride,
+                           image->getStride())){
     cerr << "Could not write image to " << outfilename << ", error = " << geterror() << endl;
     ImageOutput::destroy(outfile);
     return;
@@ -97,8 +152,30 @@ void writeimage(string outfilename=""){
   ImageOutput::destroy(outfile);
 }
 
+// float planes take 16 more bytes per pixel, huge images stay in bytes
+void makePlanes(Image *image) {
+  if ((double)image->getWidth() * image->getHeight() <= planarMegapixels * 1e6)
+    image->setPlanar(true);
+}
+
+bool hasExtension(const string &fileName, const string &extension) {
+  return fileName.size() >= extension.size() &&
+         fileName.compare(fileName.size() - extension.size(),
+                          extension.size(), extension) == 0;
+}
+
 int readimage(string name, Image **image) {
 
+    // frames of an earlier morph, OIIO may not know about QOI
+    if (hasExtension(name, ".qoi")) {
+      if (!readQoi(name, image)) {
+        cerr << "Could not read image " << name << endl;
+        return FAILURE_CODE;
+      }
+      makePlanes(*image);
+      return SUCCESS_CODE;
+    }
+
     // read the image
     ImageInput* input = ImageInput::open(name);
     if (! input)
@@ -110,26 +187,33 @@ int readimage(string name, Image **image) {
     int height = spec.height;
     int channels = spec.nchannels;
 
-		// allocate space in memory to store the image data
-    unsigned char pixmap[channels * width * height];
+    // decode straight into the rows of the image, a pixel every 4 bytes, and
+    // fill in the channels the file doesn't have afterwards. channels past
+    // RGBA are dropped
+    *image = new Image(width, height, channels);
+    int decoded = min(channels, 4);
 
-    if (!input->read_image(TypeDesc::UINT8, pixmap)) {
+    if (!input->read_image(0, decoded, TypeDesc::UINT8, (*image)->getPixmap(),
+                           4, (*image)->getStride())) {
         cerr << "Could not read image " << name << ", error = " << geterror() << endl;
         ImageInput::destroy (input);
+        delete *image;
+        *image = NULL;
         return FAILURE_CODE;
     }
     // close the file handle
     if (!input->close()) {
       cerr << "Could not close " << name << ", error = " << geterror() << endl;
       ImageInput::destroy (input);
+      delete *image;
+      *image = NULL;
       return FAILURE_CODE;
     }
 
     ImageInput::destroy(input);
 
-		// copy the pixmap into the image
-    *image = new Image(width, height, channels);
-    (*image)->copyImage(pixmap);   // make a deep copy of the pixmap
+    (*image)->completeRGBA();
+    makePlanes(*image);
 
 		return SUCCESS_CODE;  // the image was read successfully
 }
@@ -165,10 +249,9 @@ void drawImage() {
     int height = toDisplay->getHeight();
 
     // flip the image so that we can see it straight
-    Image* flipped = toDisplay->flip();
-    glDrawPixels(width, height, GL_RGBA, GL_UNSIGNED_BYTE, flipped->getPixmap());
-    flipped->destroy();
-    delete flipped;
+    Image flipped = toDisplay->flip();
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, flipped.getStride() / 4);
+    glDrawPixels(width, height, GL_RGBA, GL_UNSIGNED_BYTE, flipped.getPixmap());
 
     glFlush();
   }
@@ -177,7 +260,7 @@ void drawImage() {
 // strip the extension from the file name
 string stripExtension(string fileName) {
 
-  string extensions[3] = {".png", ".jpg", ".PNG"};
+  string extensions[4] = {".png", ".jpg", ".PNG", ".qoi"};
 
   int i = 0;  // current extension
   do {
@@ -189,7 +272,7 @@ string stripExtension(string fileName) {
 
       i++;  // go to the next extension if the current one doesn't work
   }
-  while (i < 3);
+  while (i < 4);
 
   return fileName;
 }
@@ -217,6 +300,19 @@ void writeDatFiles() {
   }
 }
 
+// write the end points of the lines in the format of the dat files
+void writeDatFile(string datName, const vector<Line> &lines) {
+
+  ofstream datFile(datName);
+
+  if (datFile) {
+    for (int i = 0; i < lines.size(); ++i) {
+      datFile << lines[i].P.x << " " << lines[i].P.y << "\n";
+      datFile << lines[i].Q.x << " " << lines[i].Q.y << "\n";
+    }
+  }
+}
+
 // merge and generate
 void generateVectors(vector<Line> &sourceLines,
                     vector<Line> &destLines) {
@@ -237,15 +333,183 @@ void generateVectors(vector<Line> &sourceLines,
   }
 }
 
-// interpolate feature vectors from destination to source
-void interpolate(const vector<Line> &sourceLines, const vector<Line> &destLines,
-                 vector<Line> &interLines,
-                 float alpha) {
+// write out frame i of the morph, on one of the writer threads. a png is
+// deflated on the threads of the pool too, in slices. a streamed frame waits
+// for the ones before it
+void writeFrame(Image *morphed, int i) {
+  static mutex consoleLock;
+  string name = streamName;
+  bool written;
+  if (frameStream)
+    written = frameStream->write(morphed, i);
+  else {
+    name = morphedImageName + to_string(i+1) + frameExtension;
+    written = frameExtension == ".qoi" ?
+              writeQoi(name, morphed, dropAlpha) :
+              writePng(name, morphed, pngOptions, pool);
+  }
+
+  // the writer reuses its buffers, the last frame is kept in a copy of its own
+  if (i == frames - 1) {
+    int width = morphed->getWidth(), height = morphed->getHeight();
+    Image *last = new Image(width, height, 4);
+    for (int y = 0; y < height; ++y)
+      memcpy(last->getRow(y), morphed->getRow(y), 4 * (size_t)width);
+    delete morphedImage;
+    morphedImage = last;
+  }
+
+  lock_guard<mutex> guard(consoleLock);
+  if (!written)
+    cerr << "Could not write image to " << name << "\n";
+  else
+    cout << "Frame " << i+1 << " complete!\n";
+}
+
+// Morph with the exact warp of a few keyframes only, the frames in between
+// interpolate the warped coordinates of the keyframes around them. From
+// every keyframe the next one is tried a number of frames ahead, and the
+// frame halfway there is warped exactly to see how far the interpolation is
+// off. Where it is off by more than the tolerance the frames in between are
+// warped exactly, tile by tile, the other frames aren't checked. If that's too many of the tiles the halfway
+// frame becomes the next keyframe candidate instead. When no tile was off at
+// all the next step is twice as long. Only four warp fields of the whole
+// image are around at any time
+void morphKeyframes(const function<void(int)> &prepareFrame,
+                    const PreparedLines &lines, FrameWriter &writer) {
+
+  if (frames < 1)
+    return;
+
+  int width = source->getWidth(), height = source->getHeight();
+  WarpField first(width, height), second(width, height), third(width, height);
+  WarpField frame(width, height);
+  WarpField *key = &first, *next = &second, *middle = &third;
+  vector<char> drifting;
+  int exact = 0, tiles = 0, exactTiles = 0;
+
+  auto warpExactly = [&](int i, WarpField &field) {
+    prepareFrame(i);
+    warpFrame(lines, warpOptions, field, pool);
+    exact++;
+  };
+  auto morphFrame = [&](int i, const WarpField &field) {
+    Image *morphed = writer.acquire();
+    source->morph(destination, morphed, field, i / (float)frames, pool);
+    writer.submit(morphed, i);
+    // the lines are prepared again before the next frame that needs them
+    if (checkWarp) {
+      prepareFrame(i);
+      float error = fieldError(lines, field);
+      cout << "Frame " << i+1 << " warp is off by up to " << error << " pixels\n";
+    }
+  };
+
+  warpExactly(0, *key);
+  morphFrame(0, *key);
+
+  int step = KEYFRAME_STEP;
+  for (int i0 = 0; i0 < frames - 1; ) {
+    int i1 = min(i0 + step, frames - 1);
+    warpExactly(i1, *next);
+
+    // halve the step until the halfway frame is close enough
+    int halfway = -1, count = 0;
+    bool halved = false;
+    while (i1 - i0 > 1) {
+      int m = (i0 + i1) / 2;
+      warpExactly(m, *middle);
+      float t = (m - i0) / (float)(i1 - i0);
+      count = driftingTiles(*key, *next, t, *middle, keyframeTolerance, drifting);
+      if (count <= drifting.size() * KEYFRAME_MAX_DRIFTING) {
+        halfway = m;
+        break;
+      }
+      swap(next, middle);
+      i1 = m;
+      halved = true;
+    }
+
+    for (int i = i0 + 1; i < i1; ++i) {
+      if (i == halfway) {
+        morphFrame(i, *middle);
+        continue;
+      }
+      if (count > 0)
+        prepareFrame(i);
+      interpolateFrame(*key, *next, (i - i0) / (float)(i1 - i0), lines,
+                       warpOptions, drifting, frame, pool);
+      morphFrame(i, frame);
+      tiles += drifting.size();
+      exactTiles += count;
+    }
+    morphFrame(i1, *next);
+
+    swap(key, next);
+    // try a longer step only when this one was plenty
+    step = halved || count > 0 ? i1 - i0 : 2 * (i1 - i0);
+    i0 = i1;
+  }
+
+  cout << exact << " frames were warped exactly";
+  if (tiles > 0)
+    cout << ", and " << 100.0f * exactTiles / tiles
+         << "% of the tiles of the interpolated ones";
+  cout << "\n";
+}
+
+// frames of a batch that fit into batchMegabytes
+int batchFrames() {
+  size_t frameBytes = 4 * (size_t)source->getWidth() * source->getHeight();
+  size_t fit = ((size_t)batchMegabytes << 20) / frameBytes;
+  return max(1, (int)min(fit, (size_t)min(frames, MAX_BATCH_FRAMES)));
+}
 
-  for (int i = 0; i < sourceLines.size(); ++i) {
-    // from destination to source
-    interLines[i].P = (1 - alpha) * destLines[i].P + alpha * sourceLines[i].P;
-    interLines[i].Q = (1 - alpha) * destLines[i].Q + alpha * sourceLines[i].Q;
+// Morph as many frames at a time as fit into batchMegabytes, in one pass
+// over the pixels, see Image::morphBatch. the lines of every frame of a
+// batch are interleaved, so the kernel can load the same line at all the
+// alphas of the batch in one go. the warp options don't apply
+void morphBatches(const vector<Line> &sourceLines,
+                  const vector<Line> &destLines, FrameWriter &writer) {
+
+  int batch = batchFrames();
+  int alphas = (batch + 15) / 16 * 16;
+  cout << "Morphing " << batch << " frames at a time\n";
+
+  vector<Image*> images(batch);
+
+  // line i at alpha k is line i * alphas + k
+  size_t count = sourceLines.size() * alphas;
+  vector<Line> batchSource(count), batchDest(count), batchInter(count);
+  vector<Line> frameLines(sourceLines.size());
+  for (size_t i = 0; i < sourceLines.size(); ++i)
+    for (int k = 0; k < alphas; ++k) {
+      batchSource[i * alphas + k] = sourceLines[i];
+      batchDest[i * alphas + k] = destLines[i];
+    }
+  PreparedLines lines;
+  vector<float> alpha(alphas);
+
+  for (int first = 0; first < frames; first += batch) {
+    int frameCount = min(batch, frames - first);
+
+    // the lanes past the last frame repeat it
+    for (int k = 0; k < alphas; ++k)
+      alpha[k] = (first + min(k, frameCount - 1)) / (float)frames;
+    for (int k = 0; k < alphas; ++k) {
+      interpolateLines(sourceLines, destLines, frameLines, alpha[k]);
+      for (size_t i = 0; i < sourceLines.size(); ++i)
+        batchInter[i * alphas + k] = frameLines[i];
+    }
+    // the batch kernel looks at every line, compact weights or not
+    lines.prepare(batchSource, batchDest, batchInter, a, b, p, radius, false);
+
+    for (int k = 0; k < frameCount; ++k)
+      images[k] = writer.acquire();
+    source->morphBatch(destination, images.data(), alpha.data(), frameCount,
+                       lines, alphas, pool);
+    for (int k = 0; k < frameCount; ++k)
+      writer.submit(images[k], first + k);
   }
 }
 
@@ -264,26 +528,91 @@ void runMorph() {
   // commit source and dest feature points to the disk
   writeDatFiles();
 
+  // merge or drop redundant lines, and keep the simplified rig next to the
+  // original one
+  if (simplifyTolerance > 0) {
+    WarpParameters parameters = { a, b, p, radius };
+    size_t before = sourceLines.size();
+    float error = simplifyLines(sourceLines, destLines, parameters,
+                                source->getWidth(), source->getHeight(),
+                                simplifyTolerance);
+    cout << "Simplified " << before << " feature lines to " << sourceLines.size()
+         << ", the warp moves by up to " << error << " pixels and should be about "
+         << before / (float)sourceLines.size() << " times faster\n";
+
+    writeDatFile(stripExtension(sourceImage) + "-simplified.dat", sourceLines);
+    writeDatFile(stripExtension(destImage) + "-simplified.dat", destLines);
+  }
+
   // allocate some space for the interpolated lines
   vector<Line> interLines(destLines.size());
+  PreparedLines lines;
 
-  Image *morphed = new Image(source->getWidth(), source->getHeight(), 4);
+  // the mesh is triangulated once, the frames only move its vertices
+  WarpMesh mesh;
+  if (warpOptions.engine == MESH_WARP) {
+    mesh.triangulate(sourceLines, destLines, source->getWidth(), source->getHeight());
+    warpOptions.mesh = &mesh;
+  }
+
+  // the frames are written out on their own threads while the next ones
+  // are morphed, into as many buffers as the morph fills at a time plus the
+  // ones in the queue
+  int morphing = batchMegabytes > 0 ? batchFrames() : 1;
+  if (!streamName.empty()) {
+    frameStream = new FrameStream(streamName, streamFormat, source->getWidth(),
+                                  source->getHeight(), streamRate);
+    if (!frameStream->good()) {
+      cerr << "Could not open the stream " << streamName << "\n";
+      exit(1);
+    }
+  }
+  FrameWriter writer(source->getWidth(), source->getHeight(),
+                     morphing + queueFrames, writerThreads, writeFrame);
+
+  // the morph only samples the inputs, they can stay in tiles throughout
+  source->setTiled(tiledImages);
+  destination->setTiled(tiledImages);
+
+  // get the lines of frame i ready for the warp
+  auto prepareFrame = [&](int i) {
+    interpolateLines(sourceLines, destLines, interLines, i / (float)frames);
+    // precompute everything about the lines that the pixels have in common
+    lines.prepare(sourceLines, destLines, interLines, a, b, p, radius);
+    if (warpOptions.treeTheta > 0)
+      lines.buildTree();
+    if (warpOptions.engine == MESH_WARP)
+      mesh.prepare(lines);
+  };
+
+  bool perFrame = batchMegabytes == 0 && keyframeTolerance == 0;
+  if (batchMegabytes > 0)
+    morphBatches(sourceLines, destLines, writer);
+  else if (keyframeTolerance > 0)
+    morphKeyframes(prepareFrame, lines, writer);
 
   // show an effect
-  for (int i = 0; i < frames; ++i) {
+  for (int i = 0; i < frames && perFrame; ++i) {
     float alpha = i / (float)frames;
     // let the morphing begin
-    interpolate(sourceLines, destLines, interLines, alpha);
-    source->morph(destination, morphed, sourceLines, destLines, interLines,
-                                            alpha, a, b, p);
-    morphedImage = morphed;
-    writeimage(morphedImageName + to_string(i+1) + ".png");
-    cout << "Frame " << i+1 << " complete!\n";
+    prepareFrame(i);
+    if (checkWarp)
+      cout << "Frame " << i+1 << " warp is off by up to "
+           << warpError(lines, warpOptions, source->getWidth(), source->getHeight())
+           << " pixels\n";
+    Image *morphed = writer.acquire();
+    source->morph(destination, morphed, lines, alpha, warpOptions, pool);
+    writer.submit(morphed, i);
   }
 
-  // free space occupied by the temp morphed image
-  morphed->destroy();
-  delete morphed;
+  // wait for the last frames to be written
+  writer.finish();
+  delete frameStream;
+  frameStream = NULL;
+
+  // back in rows for the display
+  source->setTiled(false);
+  destination->setTiled(false);
 
   cout << "Morphing complete!\n";
   toDisplay = destination;
@@ -297,8 +626,13 @@ void handleKey(unsigned char key, int x, int y) {
   switch(key) {
     case 'w':
     case 'W':
-				if (morphedImage)
-        	writeimage(morphedImageName);
+        // the last frame, to the output name with its extension
+        if (morphedImage && !streamName.empty())
+          cout << "The frames went into " << streamName << ", there is no output file to write\n";
+        else if (morphedImage && frameExtension == ".qoi")
+          writeQoi(morphedImageName + frameExtension, morphedImage, dropAlpha);
+        else if (morphedImage)
+          writeimage(morphedImage, morphedImageName + frameExtension);
         break;
     case 's':
     case 'S':
@@ -382,19 +716,191 @@ bool readParameters(string parameterFile) {
 
   pFile >> a >> b >> p;
 
+  // optionally followed by the kind of weights, compact ones need a radius
+  string weights;
+  if (pFile >> weights) {
+    if (weights.compare("compact") != 0 || !(pFile >> radius) || radius <= 0)
+      return 0;
+  }
+
   return 1;
 }
 
+void printUsage() {
+  cout << "usage: morpher [-d] [-t threads] [-i isa] [--adaptive tolerance | --mesh] [--grid size]"
+          " [--cull epsilon] [--tree theta] [--check] [--simplify tolerance]"
+          " [--keyframes tolerance | --batch megabytes] [--tiled] [--planar megapixels]"
+          " [--hugepages megabytes] [--writers threads] [--queue frames]"
+          " [--deflate level] [--filter name] [--drop-alpha] [--raw] [--fps rate]"
+          " source dest output frames <parameters>\n";
+}
+
 int main(int argc, char *argv[]){
 
   bool isDat = false;
+  // the last option given that only applies to the warp frame by frame
+  string frameWarpOption = "";
+
+  // pull out the options first, whatever is left over are the positional
+  // arguments in their usual order
+  vector<string> args;
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i];
+    if (arg.compare("-d") == 0)
+      isDat = true;
+    else if (arg.compare("-t") == 0 && i + 1 < argc)
+      threads = stoi(argv[++i]);
+    else if (arg.compare("-i") == 0 && i + 1 < argc)
+      isa = argv[++i];
+    else if (arg.compare("--adaptive") == 0 && i + 1 < argc) {
+      warpOptions.engine = ADAPTIVE_WARP;
+      warpOptions.tolerance = stof(argv[++i]);
+      frameWarpOption = arg;
+    }
+    else if (arg.compare("--mesh") == 0) {
+      warpOptions.engine = MESH_WARP;
+      frameWarpOption = arg;
+    }
+    else if (arg.compare("--grid") == 0 && i + 1 < argc) {
+      warpOptions.gridSize = stoi(argv[++i]);
+      frameWarpOption = arg;
+    }
+    else if (arg.compare("--cull") == 0 && i + 1 < argc) {
+      warpOptions.cullEpsilon = stof(argv[++i]);
+      frameWarpOption = arg;
+    }
+    else if (arg.compare("--tree") == 0 && i + 1 < argc) {
+      warpOptions.treeTheta = stof(argv[++i]);
+      frameWarpOption = arg;
+    }
+    else if (arg.compare("--check") == 0) {
+      checkWarp = true;
+      frameWarpOption = arg;
+    }
+    else if (arg.compare("--keyframes") == 0 && i + 1 < argc) {
+      keyframeTolerance = stof(argv[++i]);
+      frameWarpOption = arg;
+    }
+    else if (arg.compare("--batch") == 0 && i + 1 < argc)
+      batchMegabytes = stoi(argv[++i]);
+    else if (arg.compare("--tiled") == 0)
+      tiledImages = true;
+    else if (arg.compare("--planar") == 0 && i + 1 < argc)
+      planarMegapixels = stof(argv[++i]);
+    else if (arg.compare("--hugepages") == 0 && i + 1 < argc)
+      hugePageMegabytes = stoi(argv[++i]);
+    else if (arg.compare("--writers") == 0 && i + 1 < argc)
+      writerThreads = stoi(argv[++i]);
+    else if (arg.compare("--queue") == 0 && i + 1 < argc)
+      queueFrames = stoi(argv[++i]);
+    else if (arg.compare("--deflate") == 0 && i + 1 < argc)
+      pngOptions.level = stoi(argv[++i]);
+    else if (arg.compare("--drop-alpha") == 0)
+      dropAlpha = true;
+    else if (arg.compare("--raw") == 0)
+      rawStream = true;
+    else if (arg.compare("--fps") == 0 && i + 1 < argc)
+      streamRate = stoi(argv[++i]);
+    else if (arg.compare("--filter") == 0 && i + 1 < argc) {
+      if (!parsePngFilter(argv[++i], pngOptions.filter)) {
+        cout << "The png filter has to be none, sub, up, average, paeth or adaptive\n";
+        exit(1);
+      }
+    }
+    else if (arg.compare("--simplify") == 0 && i + 1 < argc)
+      simplifyTolerance = stof(argv[++i]);
+    else
+      args.push_back(arg);
+  }
+
+  if (args.size() < 4) {
+    printUsage();
+    exit(1);
+  }
+
+  // the frames streamed to stdout leave it to them, everything else goes
+  // to stderr
+  if (args[2] == "-")
+    cout.rdbuf(cerr.rdbuf());
+
+  // a batch is warped at all of its alphas by a kernel of its own, none of
+  // the options of the warp frame by frame apply to it
+  if (batchMegabytes > 0 && !frameWarpOption.empty()) {
+    cout << "--batch can't be combined with " << frameWarpOption
+         << ", a batch doesn't take any of the options of the warp frame by frame\n";
+    printUsage();
+    exit(1);
+  }
+
+  // the lattice cells get halved all the way down to single pixels
+  int grid = warpOptions.gridSize;
+  if (grid < 2 || (grid & (grid - 1)) != 0 || warpOptions.tolerance < 0) {
+    cout << "The grid size has to be a power of 2 and the tolerance positive\n";
+    exit(1);
+  }
+  if (warpOptions.cullEpsilon < 0 || warpOptions.cullEpsilon >= 1) {
+    cout << "The culling epsilon has to be in [0, 1)\n";
+    exit(1);
+  }
+  if (simplifyTolerance < 0 || keyframeTolerance < 0) {
+    cout << "The simplification and keyframe tolerances have to be positive\n";
+    exit(1);
+  }
+  if (batchMegabytes < 0 || planarMegapixels < 0 || hugePageMegabytes < 0) {
+    cout << "The batch memory and the planar and huge page image sizes have to be positive\n";
+    exit(1);
+  }
+  if (pngOptions.level < 0 || pngOptions.level > 9) {
+    cout << "The deflate level has to be in [0, 9]\n";
+    exit(1);
+  }
+  if (streamRate <= 0) {
+    cout << "The frame rate has to be positive\n";
+    exit(1);
+  }
+  if (writerThreads < 0 || queueFrames < 0) {
+    cout << "The writer threads and the queue length have to be positive\n";
+    exit(1);
+  }
+  if (writerThreads == 0)
+    writerThreads = max(1, min(MAX_WRITERS, (int)thread::hardware_concurrency()));
+  if (queueFrames == 0)
+    queueFrames = 2 * writerThreads;
+  if (warpOptions.treeTheta < 0 || warpOptions.treeTheta > 1) {
+    cout << "The tree theta has to be in [0, 1]\n";
+    exit(1);
+  }
+
+  // pick the kernels before anything touches the images
+  if (!isa.empty() && !selectKernels(isa.c_str())) {
+    cout << "Kernels for " << isa << " are not available on this cpu\n";
+    exit(1);
+  }
+  cout << "Using the " << getKernels()->name << " kernels\n";
+  Image::setHugePages((size_t)hugePageMegabytes << 20);
+
+  sourceImage = args[0];
+  destImage = args[1];
+  morphedImageName = args[2];
+  pngOptions.dropAlpha = dropAlpha;
+
+  // the extension of the output picks the format of the frames, "-" or a
+  // .y4m or .rgba output gets them all in one stream
+  if (hasExtension(morphedImageName, ".qoi") || hasExtension(morphedImageName, ".png")) {
+    frameExtension = morphedImageName.substr(morphedImageName.size() - 4);
+    morphedImageName.resize(morphedImageName.size() - 4);
+  }
+  else if (morphedImageName == "-" || hasExtension(morphedImageName, ".y4m") ||
+           hasExtension(morphedImageName, ".rgba")) {
+    streamName = morphedImageName;
+    bool raw = morphedImageName == "-" ? rawStream : hasExtension(morphedImageName, ".rgba");
+    streamFormat = raw ? RGBA_STREAM : Y4M_STREAM;
+  }
+  frames = stoi(args[3]);
 
   // check if the option is chosen
-  if (string(argv[1]).compare("-d") == 0) {
+  if (isDat) {
       // read in the dat files
-      sourceImage = argv[2];
-      destImage = argv[3];
-
       string sourceDat = stripExtension(sourceImage) + ".dat";
       string destDat = stripExtension(destImage) + ".dat";
 
@@ -403,61 +909,29 @@ int main(int argc, char *argv[]){
         cout << "Couldn't read dat files\n";
         exit(1);
       }
+  }
 
-      // read in the other args now
-      sourceImage = argv[2];
-      destImage = argv[3];
-      morphedImageName = argv[4];
-      frames = stoi(argv[5]);
-
-      // optional argument check
-      if (argc == 7) {
-        // read in the parameters file as well
-        if (!readParameters(argv[6])) {
-          cout << "Couldn't read parameter files\n";
-          exit(1);
-        }
-      }
-      else {
-        // ask the user for the parameters values
-        cout << "Choose the parameter values\n";
-        cout << "a: ";
-        cin >> a;
-        cout << "b: ";
-        cin >> b;
-        cout << "p: ";
-        cin >> p;
-      }
-      // we have read data from the dat files
-      isDat = true;
+  // optional argument check
+  if (args.size() == 5) {
+    // read in the parameters file as well
+    if (!readParameters(args[4])) {
+      cout << "Couldn't read parameter files\n";
+      exit(1);
+    }
   }
   else {
-      // read in the other args now
-      sourceImage = argv[1];
-      destImage = argv[2];
-      morphedImageName = argv[3];
-      frames = stoi(argv[4]);
-
-      // optional argument check
-      if (argc == 6) {
-        // read in the parameters file as well
-        if (!readParameters(argv[5])) {
-          cout << "Couldn't read parameter files\n";
-          exit(1);
-        }
-      }
-      else {
-        // ask the user for the parameters values
-        cout << "Choose the parameter values\n";
-        cout << "a: ";
-        cin >> a;
-        cout << "b: ";
-        cin >> b;
-        cout << "p: ";
-        cin >> p;
-      }
+    // ask the user for the parameters values
+    cout << "Choose the parameter values\n";
+    cout << "a: ";
+    cin >> a;
+    cout << "b: ";
+    cin >> b;
+    cout << "p: ";
+    cin >> p;
   }
 
+  pool = new ThreadPool(threads);
+
   // read in the source and destination images
   int sourceStatus = readimage(sourceImage, &source);
   int destStatus = readimage(destImage, &destination);